@@ -0,0 +1,281 @@
+/* includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../rbt.h"
+#include "../rbt_lean.h"
+#include "../rbt_learned.h"
+
+
+/* Defines */
+#define NUM_KEYS        1000000
+#define NUM_LOOKUPS     2000000
+
+#define HOT_KEYS        1000        // skewed lookups go to these keys
+#define HOT_PERCENT     90
+
+#define BATCH_SIZE      256         // keys per rb_find_batch call
+
+#define LEARNED_ERROR   16          // error bound of the learned index
+
+#define ERASE_PERCENT   10          // share of the key range erased at once
+
+#define SMALL_TREES     20000
+#define SMALL_KEYS      16          // keys per small tree
+
+
+/* Declare function prototype */
+unsigned int    next_random();
+double          elapsed_ns(struct timespec *s, struct timespec *e);
+void            run(const char *title, rb_key_t *keys, int skewed);
+void            run_small(const char *title, int small);
+void            run_lean(const char *title, rb_key_t *keys);
+void            run_learned(const char *title, rb_key_t *keys);
+void            run_erase(const char *title, rb_key_t *keys);
+
+
+/* Global variables */
+unsigned int    random_state = 2463534242u;
+
+
+/* Main function */
+int main() {
+    rb_key_t *keys;
+    int i;
+
+    if ((keys = malloc(NUM_KEYS * sizeof(rb_key_t))) == NULL) {
+        return 1;
+    }
+
+    printf("[%s]\n", rb_policy_name());
+
+    // Random ids (duplicates are simply rejected by rb_insert)
+    for (i = 0; i < NUM_KEYS; i++) {
+        keys[i] = 1000000 + next_random() % (8 * NUM_KEYS);
+    }
+    run("random ", keys, 0);
+    run("skewed ", keys, 1);
+#if RB_POLICY == RB_POLICY_RB
+    run_lean("lean   ", keys);
+#endif
+#if RB_POLICY != RB_POLICY_SPLAY
+    run_learned("learned", keys);
+#endif
+    run_erase("erase  ", keys);
+
+    // Ascending ids (worst case for unbalanced trees)
+    for (i = 0; i < NUM_KEYS; i++) {
+        keys[i] = 1000000 + i;
+    }
+    run("ordered", keys, 0);
+
+    // Many tiny trees, in node form and in small array form
+    run_small("tiny   ", 0);
+    run_small("tiny/sa", 1);
+
+    free(keys);
+
+    return 0;
+}
+
+
+/* Function implementation */
+
+/* Get pseudo random number (xorshift32) */
+unsigned int next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return random_state;
+}
+
+/* Get nanoseconds between two time points */
+double elapsed_ns(struct timespec *s, struct timespec *e) {
+    return (e->tv_sec - s->tv_sec) * 1e9 + (e->tv_nsec - s->tv_nsec);
+}
+
+/* Insert all keys, then look them up (uniformly or skewed to hot keys) */
+void run(const char *title, rb_key_t *keys, int skewed) {
+    rb_tree_t *tree = rb_create();
+    struct timespec s, e;
+    double insert_ns, find_ns, batch_ns;
+    long depth_sum = 0;
+    int i, j, idx, depth;
+
+    rb_key_t batch[BATCH_SIZE];
+    int      depths[BATCH_SIZE];
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, keys[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    insert_ns = elapsed_ns(&s, &e) / NUM_KEYS;
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_LOOKUPS; i++) {
+        if (skewed && next_random() % 100 < HOT_PERCENT) {
+            idx = next_random() % HOT_KEYS;
+        } else {
+            idx = next_random() % NUM_KEYS;
+        }
+
+        if ((depth = rb_find(tree, keys[idx], NULL)) >= 0) {
+            depth_sum += depth;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    find_ns = elapsed_ns(&s, &e) / NUM_LOOKUPS;
+
+    // Same lookups, interleaved by rb_find_batch
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_LOOKUPS; i += BATCH_SIZE) {
+        for (j = 0; j < BATCH_SIZE; j++) {
+            if (skewed && next_random() % 100 < HOT_PERCENT) {
+                batch[j] = keys[next_random() % HOT_KEYS];
+            } else {
+                batch[j] = keys[next_random() % NUM_KEYS];
+            }
+        }
+        rb_find_batch(tree, batch, BATCH_SIZE, depths, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    batch_ns = elapsed_ns(&s, &e) / i;
+
+    printf("%s  insert %7.1f ns  find %7.1f ns  batch %7.1f ns  avg depth %5.2f\n",
+        title, insert_ns, find_ns, batch_ns, (double)depth_sum / NUM_LOOKUPS);
+
+    // Trees are not freed (no rb_destroy yet), process exits right after
+}
+
+/* Insert and look up keys over many tiny trees */
+void run_small(const char *title, int small) {
+    rb_tree_t **trees;
+    struct timespec s, e;
+    double insert_ns, find_ns;
+    long depth_sum = 0;
+    int i, j, depth;
+
+    if ((trees = malloc(SMALL_TREES * sizeof(rb_tree_t *))) == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < SMALL_TREES; i++) {
+        trees[i] = small ? rb_create_small(RB_SMALL_MAX) : rb_create();
+
+        for (j = 0; j < SMALL_KEYS; j++) {
+            rb_insert(trees[i], j * 7 + 1, NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    insert_ns = elapsed_ns(&s, &e) / (SMALL_TREES * SMALL_KEYS);
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_LOOKUPS; i++) {
+        j = next_random() % SMALL_TREES;
+
+        if ((depth = rb_find(trees[j], (next_random() % SMALL_KEYS) * 7 + 1, NULL)) >= 0) {
+            depth_sum += depth;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    find_ns = elapsed_ns(&s, &e) / NUM_LOOKUPS;
+
+    printf("%s  insert %7.1f ns  find %7.1f ns  avg depth %5.2f\n",
+        title, insert_ns, find_ns, (double)depth_sum / NUM_LOOKUPS);
+
+    free(trees);
+}
+
+/* Insert all keys to a tree without parent pointers, then look them up */
+void run_lean(const char *title, rb_key_t *keys) {
+    rb_lean_tree_t *tree = rb_lean_create();
+    struct timespec s, e;
+    double insert_ns, find_ns;
+    long depth_sum = 0;
+    int i, depth;
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_lean_insert(tree, keys[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    insert_ns = elapsed_ns(&s, &e) / NUM_KEYS;
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_LOOKUPS; i++) {
+        if ((depth = rb_lean_find(tree, keys[next_random() % NUM_KEYS], NULL)) >= 0) {
+            depth_sum += depth;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    find_ns = elapsed_ns(&s, &e) / NUM_LOOKUPS;
+
+    printf("%s  insert %7.1f ns  find %7.1f ns  avg depth %5.2f\n",
+        title, insert_ns, find_ns, (double)depth_sum / NUM_LOOKUPS);
+}
+
+/* Look up keys of a frozen tree through the learned index */
+void run_learned(const char *title, rb_key_t *keys) {
+    rb_tree_t *tree = rb_create();
+    rb_learned_t *learned;
+    struct timespec s, e;
+    double build_ns, find_ns;
+    long depth_sum = 0;
+    int i, depth;
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, keys[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    learned = rb_learned_build(tree, LEARNED_ERROR);
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    build_ns = elapsed_ns(&s, &e) / tree->size;
+
+    if (learned == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (i = 0; i < NUM_LOOKUPS; i++) {
+        if ((depth = rb_learned_find(learned, keys[next_random() % NUM_KEYS], NULL)) >= 0) {
+            depth_sum += depth;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    find_ns = elapsed_ns(&s, &e) / NUM_LOOKUPS;
+
+    printf("%s  build  %7.1f ns  find %7.1f ns  avg depth %5.2f  segments %lu\n",
+        title, build_ns, find_ns, (double)depth_sum / NUM_LOOKUPS, learned->nsegs);
+
+    rb_learned_free(learned);
+}
+
+/* Erase a block of the key range at once */
+void run_erase(const char *title, rb_key_t *keys) {
+    rb_tree_t *tree = rb_create();
+    struct timespec s, e;
+    unsigned long before, erased;
+    rb_key_t lo, hi;
+    int i;
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, keys[i], NULL);
+    }
+    before = tree->size;
+
+    // Middle of the 1000000 + [0, 8 * NUM_KEYS) range
+    lo = 1000000 + 4 * NUM_KEYS;
+    hi = lo + 8 * NUM_KEYS / 100 * ERASE_PERCENT;
+
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    erased = rb_erase_range(tree, lo, hi, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &e);
+
+    printf("%s  range  %7.1f ns  per key, %lu of %lu keys erased\n",
+        title, elapsed_ns(&s, &e) / erased, erased, before);
+}
@@ -0,0 +1,86 @@
+/* includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../rbt_disk.h"
+
+
+/* Defines */
+#define NUM_KEYS        1000000
+#define NUM_LOOKUPS     200000
+
+#define POOL_PAGES      512         // 2MB buffer pool
+#define PIN_LEVELS      8           // upper levels kept in memory
+
+#define DB_FILE         "bench_disk.db"
+
+
+/* Declare function prototype */
+unsigned int    next_random();
+
+
+/* Global variables */
+unsigned int    random_state = 2463534242u;
+
+
+/* Main function */
+int main() {
+    rb_disk_t *disk;
+    rb_key_t *keys;
+    unsigned long faults, lookups;
+    int i, working_set, tree_pages;
+
+    if ((keys = malloc(NUM_KEYS * sizeof(rb_key_t))) == NULL) {
+        return 1;
+    }
+
+    unlink(DB_FILE);
+    if ((disk = rb_disk_open(DB_FILE, POOL_PAGES, PIN_LEVELS)) == NULL) {
+        fputs("rb_disk_open() error\n", stderr);
+        return 1;
+    }
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        keys[i] = 1000000 + next_random() % (8 * NUM_KEYS);
+        rb_disk_insert(disk, keys[i], i);
+    }
+
+    tree_pages = disk->nnodes / RB_DISK_PAGE_NODES + 1;
+    printf("tree pages %d, pool pages %d\n", tree_pages, POOL_PAGES);
+
+    // Look up random keys of growing working sets
+    for (working_set = 1000; working_set <= NUM_KEYS; working_set *= 10) {
+        // Warm up the pool with the working set
+        for (i = 0; i < NUM_LOOKUPS; i++) {
+            rb_disk_find(disk, keys[next_random() % working_set], NULL);
+        }
+
+        rb_disk_reset_stats(disk);
+        for (i = 0; i < NUM_LOOKUPS; i++) {
+            rb_disk_find(disk, keys[next_random() % working_set], NULL);
+        }
+        rb_disk_stats(disk, &faults, &lookups);
+
+        printf("working set %7d keys  page faults / lookup %6.3f\n",
+            working_set, (double)faults / lookups);
+    }
+
+    rb_disk_close(disk);
+    unlink(DB_FILE);
+    free(keys);
+
+    return 0;
+}
+
+
+/* Function implementation */
+
+/* Get pseudo random number (xorshift32) */
+unsigned int next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return random_state;
+}
@@ -0,0 +1,124 @@
+/* includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../rbt_wal.h"
+
+
+/* Defines */
+#define NUM_KEYS        1000000
+#define COMMIT_WINDOW   2           // group commit window (ms)
+
+#define WAL_FILE        "bench_wal.log"
+#define WAL_IMAGE       "bench_wal.log.img"
+
+
+/* Declare function prototype */
+unsigned int    next_random();
+double          now();
+int             encode_int(void *value, char *buf, int size);
+void           *decode_int(const char *buf, int len);
+
+
+/* Global variables */
+unsigned int    random_state = 2463534242u;
+
+
+/* Main function */
+int main() {
+    rb_tree_t *tree;
+    rb_wal_t *wal;
+    rb_key_t *keys;
+    double start, plain, logged;
+    int i;
+
+    if ((keys = malloc(NUM_KEYS * sizeof(rb_key_t))) == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        keys[i] = next_random();
+    }
+
+    // In-memory only
+    tree  = rb_create();
+    start = now();
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, keys[i], NULL);
+    }
+    plain = now() - start;
+
+    // Same inserts made durable through the log
+    unlink(WAL_FILE);
+    unlink(WAL_IMAGE);
+
+    tree = rb_create();
+    if ((wal = rb_wal_open(tree, WAL_FILE, encode_int, decode_int, NULL, COMMIT_WINDOW)) == NULL) {
+        fputs("rb_wal_open() error\n", stderr);
+        return 1;
+    }
+
+    start = now();
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, keys[i], (void *)(long)i);
+    }
+    rb_wal_sync(wal);
+    logged = now() - start;
+
+    printf("in memory %8.1f ns/insert\n", plain * 1e9 / NUM_KEYS);
+    printf("with wal  %8.1f ns/insert  %lu records in %lu fsyncs\n",
+        logged * 1e9 / NUM_KEYS, wal->committed, wal->groups);
+
+    rb_wal_close(wal);
+    unlink(WAL_FILE);
+    unlink(WAL_IMAGE);
+    free(keys);
+
+    return 0;
+}
+
+
+/* Function implementation */
+
+/* Get pseudo random number (xorshift32) */
+unsigned int next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return random_state;
+}
+
+/* Get monotonic time in seconds */
+double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Value is the integer itself */
+int encode_int(void *value, char *buf, int size) {
+    int v = (int)(long)value;
+
+    if (size < (int)sizeof(v)) {
+        return -1;
+    }
+    memcpy(buf, &v, sizeof(v));
+
+    return sizeof(v);
+}
+
+void *decode_int(const char *buf, int len) {
+    int v = 0;
+
+    if (len == (int)sizeof(v)) {
+        memcpy(&v, buf, sizeof(v));
+    }
+
+    return (void *)(long)v;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "board.h"
+
+/* Compare entries, negative if a precedes b (same order as rank_cmp) */
+static int entry_cmp(int money_a, rb_key_t id_a, int money_b, rb_key_t id_b) {
+    if (money_a != money_b) {
+        return (money_a > money_b) ? -1 : 1;
+    }
+    if (id_a != id_b) {
+        return (id_a < id_b) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Get height of the sub-tree */
+static int height(board_node_t *node) {
+    return (node == NULL) ? 0 : node->height;
+}
+
+/* Get number of entries in the sub-tree */
+static long count(board_node_t *node) {
+    return (node == NULL) ? 0 : node->count;
+}
+
+/* Renew height and count of the node from its children */
+static void update(board_node_t *node) {
+    int hl = height(node->left);
+    int hr = height(node->right);
+
+    node->height = ((hl > hr) ? hl : hr) + 1;
+    node->count  = count(node->left) + count(node->right) + 1;
+}
+
+/* Rotate the left child above the node */
+static board_node_t *rotate_right(board_node_t *node) {
+    board_node_t *child = node->left;
+
+    node->left   = child->right;
+    child->right = node;
+
+    update(node);
+    update(child);
+
+    return child;
+}
+
+/* Rotate the right child above the node */
+static board_node_t *rotate_left(board_node_t *node) {
+    board_node_t *child = node->right;
+
+    node->right = child->left;
+    child->left = node;
+
+    update(node);
+    update(child);
+
+    return child;
+}
+
+/* Restore balance of the node, returning the new sub-tree root */
+static board_node_t *rebalance(board_node_t *node) {
+    int balance;
+
+    update(node);
+    balance = height(node->left) - height(node->right);
+
+    if (balance > 1) {
+        // Left heavy
+        if (height(node->left->left) < height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+
+    } else if (balance < -1) {
+        // Right heavy
+        if (height(node->right->right) < height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+
+    return node;
+}
+
+/* Insert the entry into the sub-tree (*done is 0 if it already exists) */
+static board_node_t *insert(board_node_t *root, board_node_t *entry, int *done) {
+    int cmp;
+
+    if (root == NULL) {
+        *done = 1;
+        return entry;
+    }
+
+    cmp = entry_cmp(entry->money, entry->id, root->money, root->id);
+
+    if (cmp < 0) {
+        root->left = insert(root->left, entry, done);
+    } else if (cmp > 0) {
+        root->right = insert(root->right, entry, done);
+    } else {
+        *done = 0;
+        return root;
+    }
+
+    return rebalance(root);
+}
+
+/* Take the first entry out of the sub-tree */
+static board_node_t *take_first(board_node_t *root, board_node_t **first) {
+    if (root->left == NULL) {
+        *first = root;
+        return root->right;
+    }
+
+    root->left = take_first(root->left, first);
+
+    return rebalance(root);
+}
+
+/* Take the entry out of the sub-tree (*found is NULL if absent) */
+static board_node_t *take(board_node_t *root, int money, rb_key_t id, board_node_t **found) {
+    board_node_t *next;
+    int cmp;
+
+    if (root == NULL) {
+        *found = NULL;
+        return NULL;
+    }
+
+    cmp = entry_cmp(money, id, root->money, root->id);
+
+    if (cmp < 0) {
+        root->left = take(root->left, money, id, found);
+    } else if (cmp > 0) {
+        root->right = take(root->right, money, id, found);
+    } else {
+        *found = root;
+
+        if (root->left == NULL || root->right == NULL) {
+            return (root->left != NULL) ? root->left : root->right;
+        }
+
+        // Next entry takes the place
+        root->right = take_first(root->right, &next);
+        next->left  = root->left;
+        next->right = root->right;
+        root = next;
+    }
+
+    return rebalance(root);
+}
+
+/* Compare entries through pointers, for qsort */
+static int node_cmp(const void *a, const void *b) {
+    const board_node_t *x = *(board_node_t * const *)a;
+    const board_node_t *y = *(board_node_t * const *)b;
+
+    return entry_cmp(x->money, x->id, y->money, y->id);
+}
+
+/* Link the sorted entries [lo, hi) into a balanced sub-tree, returning its root */
+static board_node_t *link(board_node_t **sorted, long lo, long hi) {
+    board_node_t *root;
+    long mid;
+
+    if (lo >= hi) {
+        return NULL;
+    }
+
+    mid  = lo + (hi - lo) / 2;
+    root = sorted[mid];
+
+    root->left  = link(sorted, lo, mid);
+    root->right = link(sorted, mid + 1, hi);
+    update(root);
+
+    return root;
+}
+
+/* Create leaderboard */
+board_t *board_create() {
+    board_t *board = NULL;
+
+    if ((board = malloc(sizeof(board_t))) == NULL) {
+        return NULL;
+    }
+
+    board->root = NULL;
+
+    return board;
+}
+
+/* Add the entry (-1 if it already exists) */
+int board_insert(board_t *board, int money, rb_key_t id, void *value) {
+    board_node_t *entry;
+    int done;
+
+    if ((entry = malloc(sizeof(board_node_t))) == NULL) {
+        return -1;
+    }
+
+    memset(entry, 0, sizeof(board_node_t));
+    entry->money  = money;
+    entry->id     = id;
+    entry->value  = value;
+    entry->height = 1;
+    entry->count  = 1;
+
+    board->root = insert(board->root, entry, &done);
+
+    if (!done) {
+        free(entry);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Fill the empty leaderboard with the slots [first, last) of the money and id arrays
+ * (ids distinct), the value of each entry is its slot -> O(n log n)
+ * -1 if the board isn't empty or out of memory */
+int board_build(board_t *board, const int *money, const rb_key_t *ids, long first, long last) {
+    board_node_t **sorted;
+    long n = last - first, i;
+
+    if (board->root != NULL || (sorted = malloc((n + 1) * sizeof(board_node_t*))) == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((sorted[i] = malloc(sizeof(board_node_t))) == NULL) {
+            while (i-- > 0) {
+                free(sorted[i]);
+            }
+            free(sorted);
+            return -1;
+        }
+
+        sorted[i]->money = money[first + i];
+        sorted[i]->id    = ids[first + i];
+        sorted[i]->value = (void*)(intptr_t)(first + i);
+    }
+
+    // One sort, then a perfectly balanced tree (a valid AVL tree)
+    qsort(sorted, n, sizeof(board_node_t*), node_cmp);
+    board->root = link(sorted, 0, n);
+
+    free(sorted);
+
+    return 0;
+}
+
+/* Move the entry to its new money (-1 if absent), O(log n) */
+int board_move(board_t *board, int money, rb_key_t id, int new_money) {
+    board_node_t *entry;
+    int done;
+
+    if (money == new_money) {
+        return 0;
+    }
+
+    board->root = take(board->root, money, id, &entry);
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    entry->left   = NULL;
+    entry->right  = NULL;
+    entry->money  = new_money;
+    entry->height = 1;
+    entry->count  = 1;
+
+    board->root = insert(board->root, entry, &done);
+
+    return 0;
+}
+
+/* Get the entry at the position (0 is the first, NULL past the last) */
+board_node_t *board_at(board_t *board, long k) {
+    board_node_t *node = board->root;
+
+    while (node != NULL) {
+        if (k < count(node->left)) {
+            node = node->left;
+        } else if (k == count(node->left)) {
+            return node;
+        } else {
+            k   -= count(node->left) + 1;
+            node = node->right;
+        }
+    }
+
+    return NULL;
+}
+
+/* Get rank of the entry (1 is the first, 0 if absent) */
+long board_rank(board_t *board, int money, rb_key_t id) {
+    board_node_t *node = board->root;
+    long before = 0;
+    int cmp;
+
+    while (node != NULL) {
+        cmp = entry_cmp(money, id, node->money, node->id);
+
+        if (cmp < 0) {
+            node = node->left;
+        } else if (cmp > 0) {
+            before += count(node->left) + 1;
+            node    = node->right;
+        } else {
+            return before + count(node->left) + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Get number of entries */
+long board_size(board_t *board) {
+    return count(board->root);
+}
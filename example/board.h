@@ -0,0 +1,37 @@
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+#include "../rbt.h"
+
+// Leaderboard entry (AVL node counting its sub-tree for rank queries)
+struct board_node_s {
+    struct board_node_s *left;
+    struct board_node_s *right;
+
+    int       money;
+    rb_key_t  id;
+    void     *value;
+
+    int       height;   // height of sub-tree (leaf is 1)
+    long      count;    // entries in sub-tree
+};
+
+// Leaderboard ordered by money (descending) and then id (ascending)
+struct board_s {
+    struct board_node_s *root;
+};
+
+typedef struct board_node_s board_node_t;
+typedef struct board_s board_t;
+
+
+// Leaderboard implementation
+board_t      *board_create();
+int           board_insert(board_t *board, int money, rb_key_t id, void *value);
+int           board_build(board_t *board, const int *money, const rb_key_t *ids, long first, long last);
+int           board_move(board_t *board, int money, rb_key_t id, int new_money);
+board_node_t *board_at(board_t *board, long k);
+long          board_rank(board_t *board, int money, rb_key_t id);
+long          board_size(board_t *board);
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "cdc.h"
+
+/* Register interest in the count, returning the value to sleep on
+ * (the caller checks its condition again before sleeping) */
+static unsigned count_prepare(cdc_count_t *count) {
+    atomic_fetch_add(&count->waiters, 1);
+
+    return atomic_load(&count->seq);
+}
+
+/* Sleep until the count moves past the value, then withdraw the interest */
+static void count_wait(cdc_count_t *count, unsigned seq) {
+    syscall(SYS_futex, &count->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+
+    atomic_fetch_sub(&count->waiters, 1);
+}
+
+/* Withdraw the interest without sleeping (the condition already holds) */
+static void count_cancel(cdc_count_t *count) {
+    atomic_fetch_sub(&count->waiters, 1);
+}
+
+/* Wake the sleepers after a change of the ring (only a fence if none) */
+static void count_notify(cdc_count_t *count) {
+    // Pairs with the waiter's registration, so one of the two sees the other
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&count->waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&count->seq, 1);
+        syscall(SYS_futex, &count->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* Create ring of at least the capacity (rounded up to a power of 2)
+ * each side polls spin times before it sleeps */
+cdc_ring_t *cdc_create(unsigned long capacity, int spin) {
+    cdc_ring_t *ring;
+    unsigned long size = 1;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    if ((ring = aligned_alloc(64, (sizeof(cdc_ring_t) + 63) & ~63UL)) == NULL) {
+        return NULL;
+    }
+
+    if ((ring->events = malloc(size * sizeof(cdc_event_t))) == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->mask      = size - 1;
+    ring->spin      = spin;
+    ring->tail_seen = 0;
+    ring->head_seen = 0;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closed, 0);
+    atomic_init(&ring->published.seq, 0);
+    atomic_init(&ring->published.waiters, 0);
+    atomic_init(&ring->released.seq, 0);
+    atomic_init(&ring->released.waiters, 0);
+
+    return ring;
+}
+
+/* Check whether the ring has room for one more event (producer only) */
+static int has_room(cdc_ring_t *ring, unsigned long head) {
+    // Tail is read again only when the cached one says full
+    if (head - ring->tail_seen > ring->mask) {
+        ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+
+    return head - ring->tail_seen <= ring->mask;
+}
+
+/* Publish the event (producer only), waiting while the ring is full */
+void cdc_publish(cdc_ring_t *ring, const cdc_event_t *event) {
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned seq;
+    int polls = 0;
+
+    while (!has_room(ring, head)) {
+        if (++polls < ring->spin) {
+            continue;
+        }
+
+        seq = count_prepare(&ring->released);
+        if (has_room(ring, head)) {
+            count_cancel(&ring->released);
+        } else {
+            count_wait(&ring->released, seq);
+        }
+    }
+
+    ring->events[head & ring->mask] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    count_notify(&ring->published);
+}
+
+/* Tell the consumer no more events come (producer only) */
+void cdc_close(cdc_ring_t *ring) {
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+
+    count_notify(&ring->published);
+}
+
+/* Get the next event in place (consumer only), 0 if the ring is empty */
+int cdc_peek(cdc_ring_t *ring, cdc_event_t **event) {
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == ring->head_seen) {
+        ring->head_seen = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->head_seen) {
+            return 0;
+        }
+    }
+
+    *event = &ring->events[tail & ring->mask];
+
+    return 1;
+}
+
+/* Get the next event in place (consumer only), waiting for one
+ * returns 0 once the ring is closed and every event is taken */
+int cdc_next(cdc_ring_t *ring, cdc_event_t **event) {
+    unsigned seq;
+    int polls = 0;
+
+    while (!cdc_peek(ring, event)) {
+        // Events published before the close are visible by now
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            return cdc_peek(ring, event);
+        }
+
+        if (++polls < ring->spin) {
+            continue;
+        }
+
+        seq = count_prepare(&ring->published);
+        if (cdc_peek(ring, event)) {
+            count_cancel(&ring->published);
+            return 1;
+        }
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            count_cancel(&ring->published);
+            continue;
+        }
+        count_wait(&ring->published, seq);
+    }
+
+    return 1;
+}
+
+/* Release the peeked event once it is applied (consumer only) */
+void cdc_release(cdc_ring_t *ring) {
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    count_notify(&ring->released);
+}
+
+/* Check whether every published event has been applied
+ * (effects of the applied events are visible to the caller afterwards) */
+int cdc_drained(cdc_ring_t *ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_acquire)
+        == atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+/* Wait until every published event has been applied (producer only) */
+void cdc_drain(cdc_ring_t *ring) {
+    unsigned seq;
+    int polls = 0;
+
+    while (!cdc_drained(ring)) {
+        if (++polls < ring->spin) {
+            continue;
+        }
+
+        seq = count_prepare(&ring->released);
+        if (cdc_drained(ring)) {
+            count_cancel(&ring->released);
+        } else {
+            count_wait(&ring->released, seq);
+        }
+    }
+}
+
+/* Free the ring */
+void cdc_free(cdc_ring_t *ring) {
+    free(ring->events);
+    free(ring);
+}
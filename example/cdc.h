@@ -0,0 +1,63 @@
+#ifndef __CDC_H__
+#define __CDC_H__
+
+#include <stdatomic.h>
+
+#include "../rbt.h"
+
+#define CDC_JOIN    1       // a member joined with its initial balance
+#define CDC_CASH    2       // balance of a member changed by delta
+
+// Change event of a member balance (fixed size, copied through the ring)
+struct cdc_event_s {
+    int       kind;         // CDC_*
+    rb_key_t  id;
+    long      slot;         // row of the member in the member table
+    int       delta;
+    int       balance;      // balance after the change
+    int       cell;         // x * 1001 + y of a traded area, -1 otherwise
+    int       updown;       // direction logged for the change
+    void     *log;          // log list of the member
+};
+
+// Event count, a side that found nothing to do sleeps on it (futex)
+// until the other side bumps it, which costs a syscall only while someone sleeps
+struct cdc_count_s {
+    atomic_uint         seq;
+    atomic_int          waiters;
+};
+
+// Lock-free ring of events, one producer thread and one consumer thread
+// each side spins a little, then sleeps until the other side moves
+struct cdc_ring_s {
+    struct cdc_event_s *events;
+    unsigned long       mask;       // capacity - 1 (capacity is a power of 2)
+    int                 spin;       // polls before sleeping
+
+    _Alignas(64) atomic_ulong head; // next event to publish (producer)
+    unsigned long       tail_seen;  // last tail read by the producer
+    struct cdc_count_s  published;  // bumped when head moves, or on close
+    atomic_int          closed;
+
+    _Alignas(64) atomic_ulong tail; // next event to consume (consumer)
+    unsigned long       head_seen;  // last head read by the consumer
+    struct cdc_count_s  released;   // bumped when tail moves
+};
+
+typedef struct cdc_event_s cdc_event_t;
+typedef struct cdc_count_s cdc_count_t;
+typedef struct cdc_ring_s cdc_ring_t;
+
+
+// Ring implementation
+cdc_ring_t *cdc_create(unsigned long capacity, int spin);
+void        cdc_publish(cdc_ring_t *ring, const cdc_event_t *event);
+void        cdc_close(cdc_ring_t *ring);
+int         cdc_peek(cdc_ring_t *ring, cdc_event_t **event);
+int         cdc_next(cdc_ring_t *ring, cdc_event_t **event);
+void        cdc_release(cdc_ring_t *ring);
+int         cdc_drained(cdc_ring_t *ring);
+void        cdc_drain(cdc_ring_t *ring);
+void        cdc_free(cdc_ring_t *ring);
+
+#endif
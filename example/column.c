@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "column.h"
+
+#define COLUMN_INITIAL  1024
+
+/* Check whether slot a precedes slot b (money descending, then id ascending) */
+static int precedes(column_t *column, long a, long b) {
+    if (column->money[a] != column->money[b]) {
+        return column->money[a] > column->money[b];
+    }
+    return column->ids[a] < column->ids[b];
+}
+
+/* Create empty column */
+column_t *column_create() {
+    column_t *column = NULL;
+
+    if ((column = malloc(sizeof(column_t))) == NULL) {
+        return NULL;
+    }
+
+    column->ids   = malloc(COLUMN_INITIAL * sizeof(rb_key_t));
+    column->money = malloc(COLUMN_INITIAL * sizeof(int));
+    column->count = 0;
+    column->cap   = COLUMN_INITIAL;
+
+    if (column->ids == NULL || column->money == NULL) {
+        free(column->ids);
+        free(column->money);
+        free(column);
+        return NULL;
+    }
+
+    return column;
+}
+
+/* Make room for cap slots in all (-1 on failure) */
+int column_reserve(column_t *column, long cap) {
+    rb_key_t *ids;
+    int *moneys;
+
+    if (cap <= column->cap) {
+        return 0;
+    }
+
+    if ((ids = realloc(column->ids, cap * sizeof(rb_key_t))) == NULL) {
+        return -1;
+    }
+    column->ids = ids;
+
+    if ((moneys = realloc(column->money, cap * sizeof(int))) == NULL) {
+        return -1;
+    }
+    column->money = moneys;
+
+    column->cap = cap;
+
+    return 0;
+}
+
+/* Append a member, returning its slot (-1 on failure) */
+long column_add(column_t *column, rb_key_t id, int money) {
+    if (column->count == column->cap && column_reserve(column, 2 * column->cap) == -1) {
+        return -1;
+    }
+
+    column->ids[column->count]   = id;
+    column->money[column->count] = money;
+
+    return column->count++;
+}
+
+/* Sift the heap root down (root is the last of the kept slots) */
+static void heap_down(column_t *column, long *heap, int n, int i) {
+    long tmp;
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && precedes(column, heap[child], heap[child + 1])) {
+            child++;
+        }
+        if (!precedes(column, heap[i], heap[child])) {
+            break;
+        }
+
+        tmp = heap[i]; heap[i] = heap[child]; heap[child] = tmp;
+        i = child;
+    }
+}
+
+/* Offer the slot to the heap of the best k so far */
+static void heap_offer(column_t *column, long *heap, int *n, int k, long slot) {
+    int i;
+    long tmp;
+
+    if (*n < k) {
+        // Sift up
+        for (i = (*n)++, heap[i] = slot; i > 0; i = (i - 1) / 2) {
+            if (!precedes(column, heap[(i - 1) / 2], heap[i])) {
+                break;
+            }
+            tmp = heap[i]; heap[i] = heap[(i - 1) / 2]; heap[(i - 1) / 2] = tmp;
+        }
+    } else if (precedes(column, slot, heap[0])) {
+        heap[0] = slot;
+        heap_down(column, heap, *n, 0);
+    }
+}
+
+/* Get slots of the first k members with money above the floor, in rank order
+ * only moneys reaching the current k-th one leave the vector filter
+ * returns the number of slots found */
+int column_top_k(column_t *column, int k, int floor, long *slots) {
+    long i = 0, tmp;
+    int n = 0, threshold = floor + 1, mask;
+
+    if (k <= 0) {
+        return 0;
+    }
+
+#ifdef __AVX2__
+    for (; i + 8 <= column->count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(column->money + i));
+
+        // money >= threshold, ties need the id check
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpgt_epi32(v, _mm256_set1_epi32(threshold - 1))));
+
+        while (mask != 0) {
+            heap_offer(column, slots, &n, k, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+
+            if (n == k) {
+                threshold = column->money[slots[0]];
+            }
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= column->count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(column->money + i));
+
+        mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(v, _mm_set1_epi32(threshold - 1))));
+
+        while (mask != 0) {
+            heap_offer(column, slots, &n, k, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+
+            if (n == k) {
+                threshold = column->money[slots[0]];
+            }
+        }
+    }
+#endif
+
+    for (; i < column->count; i++) {
+        if (column->money[i] >= threshold) {
+            heap_offer(column, slots, &n, k, i);
+
+            if (n == k) {
+                threshold = column->money[slots[0]];
+            }
+        }
+    }
+
+    // Heap to rank order (last one out goes first)
+    for (i = n - 1; i > 0; i--) {
+        tmp = slots[0]; slots[0] = slots[i]; slots[i] = tmp;
+        heap_down(column, slots, i, 0);
+    }
+
+    return n;
+}
+
+/* Get rank of the member (1 is the first), counting members before it */
+long column_rank(column_t *column, rb_key_t id, int money) {
+    long i = 0, before = 0;
+
+#ifdef __AVX2__
+    // Unsigned ids compare as signed after flipping the sign bits
+    __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    __m256i m    = _mm256_set1_epi32(money);
+    __m256i key  = _mm256_xor_si256(_mm256_set1_epi32((int)id), bias);
+
+    for (; i + 8 <= column->count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(column->money + i));
+        __m256i d = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)(column->ids + i)), bias);
+        __m256i ahead = _mm256_or_si256(_mm256_cmpgt_epi32(v, m),
+            _mm256_and_si256(_mm256_cmpeq_epi32(v, m), _mm256_cmpgt_epi32(key, d)));
+
+        before += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(ahead)));
+    }
+#elif defined(__SSE2__)
+    __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    __m128i m    = _mm_set1_epi32(money);
+    __m128i key  = _mm_xor_si128(_mm_set1_epi32((int)id), bias);
+
+    for (; i + 4 <= column->count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(column->money + i));
+        __m128i d = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(column->ids + i)), bias);
+        __m128i ahead = _mm_or_si128(_mm_cmpgt_epi32(v, m),
+            _mm_and_si128(_mm_cmpeq_epi32(v, m), _mm_cmpgt_epi32(key, d)));
+
+        before += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(ahead)));
+    }
+#endif
+
+    for (; i < column->count; i++) {
+        before += (column->money[i] > money
+            || (column->money[i] == money && column->ids[i] < id));
+    }
+
+    return before + 1;
+}
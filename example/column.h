@@ -0,0 +1,24 @@
+#ifndef __COLUMN_H__
+#define __COLUMN_H__
+
+#include "../rbt.h"
+
+// Hot columns (id, money) of the members table, one slot per member, scanned at memory speed
+struct column_s {
+    rb_key_t *ids;
+    int      *money;
+    long      count;
+    long      cap;
+};
+
+typedef struct column_s column_t;
+
+
+// Column implementation
+column_t   *column_create();
+int         column_reserve(column_t *column, long cap);
+long        column_add(column_t *column, rb_key_t id, int money);
+int         column_top_k(column_t *column, int k, int floor, long *slots);
+long        column_rank(column_t *column, rb_key_t id, int money);
+
+#endif
@@ -1,10 +1,21 @@
 /* includes */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../rbt.h"
+#include "board.h"
+#include "column.h"
+#include "cdc.h"
+#include "grid.h"
+#include "intern.h"
 
 
 /* Defines */
@@ -14,50 +25,195 @@
 #define UP              1
 #define DOWN            0
 
-#define RANK_MAX        10
+#define TOP_DEFAULT     5           // members listed by F without a count
+#define TOP_STACK       256         // top K slots kept on the stack by the scan
+
+// Build with -DRANK_BY_SCAN to rank by scanning the id and money arrays of members
+// instead of the leaderboard tree (cheaper updates, O(n / width) F and K)
+
+#define CACHE_SLOTS     4096
+
+#define FILTER_KEYS     1000000     // expected number of members
+#define FILTER_FP_RATE  0.01
+#define FILTER_BUDGET   (2 << 20)   // bytes
+
+#define DENSE_DENSITY   0.02        // ids per slot of the id range
+
+#define NAME_SIZE       21          // bytes of a name (cut longer ones), NUL included
+#define PHONE_SIZE      12
+#define PHONE_DIGITS    15          // longest phone packed as digits
+#define PHONE_INTERNED  (1ULL << 63) // packed phone is an id in the string pool
+
+#define LOAD_THREADS    4
+#define LOAD_MIN_PART   (1 << 20)   // bytes of member file per loading thread
+
+#define LOG_CHUNK_MIN   4           // entries of the first log chunk of a member
+#define LOG_CLASSES     6           // chunk sizes LOG_CHUNK_MIN << 0 .. 5
+#define LOG_ARENA_BLOCK (1 << 20)   // bytes taken from malloc at once for log chunks
+#define LOG_HOT_MAX     256         // most entries of a member in memory (spilled beyond)
+#define LOG_HOT_KEEP    64          // newest entries a spill leaves in memory (whole chunks)
+#define LOG_RUN_MAX     LOG_HOT_MAX // most entries of one spilled run
+
+// A spill at LOG_HOT_MAX entries has to leave fewer than that in memory
+#if (LOG_CHUNK_MIN << (LOG_CLASSES - 1)) > LOG_HOT_MAX - LOG_HOT_KEEP
+#error "largest log chunk must fit in LOG_HOT_MAX - LOG_HOT_KEEP entries"
+#endif
+
+#define LOG_SEGMENT_DIR  "/tmp"         // segment files go here, unless $TMPDIR is set
+#define LOG_SEGMENT_NAME "log_segment"  // spilled logs go to <dir>/log_segment.<pid>.<n>
+#define LOG_SEGMENT_SIZE (64 << 20)     // bytes of one segment file
+
+#define CHANGE_RING     4096        // balance change events in flight
+#define CHANGE_SPIN     256         // polls of the change stream before a side sleeps
+
+#define QUERY_BLOCK     (1 << 20)   // bytes read at once when queries aren't mappable
+#define RESULT_BUFFER   (1 << 20)   // bytes of output written at once
 
 
 /* Structures */
 
-// Log node structure (including information about each log of account)
-struct log_node_s {
+// Log entry (one cash movement of the account)
+struct log_entry_s {
     int updown;
     int amount;
-    struct log_node_s *next;
 };
 
-// Log list structure
+// Chunk of contiguous log entries (oldest first, newest at count - 1)
+struct log_chunk_s {
+    struct log_chunk_s *next;       // older chunk
+    int                 count;
+    int                 cls;        // holds LOG_CHUNK_MIN << cls entries
+    struct log_entry_s  entries[];
+};
+
+// Entries spilled to a segment file at once (delta + varint encoded, oldest first)
+struct log_run_s {
+    struct log_run_s   *next;       // older run
+    int                 segment;
+    unsigned int        offset;
+    int                 count;
+};
+
+// Log list structure (newest chunk first, then older spilled runs)
 struct log_list_s {
-    struct log_node_s *head;
+    struct log_chunk_s *head;
+    struct log_run_s   *runs;
+    int                 hot;        // entries in chunks
 };
 
-// Information of each member
+// Segment files of spilled logs, mapped and appended in turn
+struct log_segments_s {
+    char              **maps;
+    int                 count, cap;
+    size_t              used;       // bytes of the last segment
+    int                 failed;     // a segment couldn't be made, logs stay in memory
+};
+
+// Arena of log chunks, freed chunks are kept per size for reuse
+struct log_arena_s {
+    char               *block;      // current block, first word links older blocks
+    size_t              used;
+    struct log_chunk_s *free[LOG_CLASSES];
+};
+
+// Cold information of each member (hot fields live in the member table)
 struct member_s {
-    char name[21];
-    char phone[12];
-    int  x, y;
-    int  level;
-    int  money;
-    struct log_list_s *log;
-    int  is_ranked;
+    uint64_t     phone;         // packed by phone_pack
+    int         *cells;         // owned areas (x * 1001 + y), in no order
+    unsigned int name;          // id in the string pool
+    int          x, y;
+    int          ncells, cells_cap;
+};
+
+// Name and phone of a row, kept until the row is added to the table
+struct load_text_s {
+    char name[NAME_SIZE];
+    char phone[PHONE_SIZE];
+};
+
+// Members by dense slot (the tree maps id to slot), one array per field
+struct member_table_s {
+    column_t           *hot;    // id and money of each slot, count of slots
+    unsigned char      *level;
+    struct log_list_s **log;    // read on every balance change, so kept apart from cold
+    struct member_s    *cold;
+    long                cap;    // slots allocated for level, log and cold
 };
 
-typedef struct log_node_s log_node_t;
+// Part of the member file, parsed by one thread
+struct load_part_s {
+    const char        *begin;
+    const char        *end;     // right after a newline (or end of file)
+    long               base;    // first table slot of this part
+    struct log_list_s *logs;
+    struct load_text_s *texts;
+    long               count;   // rows in the part (upper bound, then parsed)
+};
+
+// Query input (whole file mapped, or read in blocks)
+struct query_in_s {
+    char   *buf;
+    size_t  pos, len;
+    int     mapped;
+    int     eof;
+};
+
+// Result output (flushed in big writes)
+struct result_out_s {
+    char    buf[RESULT_BUFFER];
+    size_t  len;
+};
+
+typedef struct log_entry_s log_entry_t;
+typedef struct log_chunk_s log_chunk_t;
+typedef struct log_run_s log_run_t;
 typedef struct log_list_s log_list_t;
 typedef struct member_s member_t;
+typedef struct load_text_s load_text_t;
+typedef struct load_part_s load_part_t;
 
 
 /* Declare function prototype */
 
 // Log(list) implementation
 log_list_t *log_create();
-log_node_t *log_create_node();
-void        log_delete();
+log_chunk_t *log_create_chunk(int cls);
 void        log_insert(log_list_t *list, int ud, int amt);
-
-// Member creation
-member_t   *create_member();
-void        delete_member();
+int         log_spill(log_list_t *list);
+char       *log_segment_reserve(size_t size, int *segment, unsigned int *offset);
+int         log_read_run(log_run_t *run, log_entry_t *entries);
+
+// Member table
+void        member_reserve(long cap);
+long        member_add(rb_key_t id, member_t *cold, int money);
+long        member_slot(rb_node_t *node);
+uint64_t    phone_pack(const char *phone);
+const char *phone_unpack(uint64_t phone, char *buf);
+void        set_level(long slot);
+
+// Member list loading
+long        load_members(const char *filename);
+void       *load_count(void *arg);
+void       *load_parse(void *arg);
+void        load_run(void *(*fn)(void *), load_part_t *parts, int nparts);
+const char *skip_space(const char *p, const char *end);
+const char *parse_int(const char *p, const char *end, long *value);
+const char *parse_word(const char *p, const char *end, char *buf, int size);
+
+// Query input and result output
+void        in_open();
+int         in_peek();
+int         in_char();
+void        in_skip_space();
+void        in_skip_blank();
+unsigned    in_uint();
+int         in_int();
+void        in_word(char *buf, int size);
+void        in_line(char *buf, int size);
+void        out_flush();
+void        out_str(const char *str);
+void        out_int(long value);
+void        out_char(char c);
 
 // Main wrapper functions
 void        Init();
@@ -65,35 +221,68 @@ int         Setup();
 void        Execute();
 
 // Execute wrapper functions
-int         execute_operation(char op);
+int         execute_operation(int op);
 void        op_join_member();
 void        op_print_info();
 void        op_add_cash();
-void        op_find_top_five();
+void        op_find_top();
+void        op_find_rank();
 void        op_print_log();
 void        op_buy_area();
-
-// Rank setup by depth first search traversal
-void        traverse_dfs(rb_tree_t *tree);
-void        traverse_dfs_node(rb_node_t *node);
-
+void        op_area_sum();
+void        op_area_owned();
+void        op_area_max();
+void        op_list_cells();
+void        op_count_cells();
+void        in_area(int *x1, int *y1, int *x2, int *y2);
+
+// Leaderboard
+void        board_load(long first, long last);
+void        board_join(rb_key_t id, long slot, int money);
+void        board_renew(rb_key_t id, int old_money, int money);
+long        board_count();
+
+// Owned areas of members
+void        cells_add(long slot, int x, int y);
+void        cells_remove(long slot, int x, int y);
+
+// Balance change stream (logs and leaderboard are kept by the consumer thread)
+void        change_start();
+void        change_stop();
+void        change_wait();
+void        change_publish(int kind, rb_key_t id, long slot, int delta, int updown, int cell);
+void       *change_consume(void *arg);
+void        change_apply(cdc_event_t *event);
+void        add_cash(rb_key_t id, long slot, int amount, int updown, int cell);
 
 /* Global variables */
-rb_tree_t      *all_members;
+rb_tree_t      *all_members;   // id -> slot of members
+struct member_table_s members;
+intern_t       *strings;        // names of members (and phones that aren't digits)
 int             area_price[1001][1001];
 int             area_owner[1001][1001];
+grid_t         *area_grid;      // aggregates of area_price and area_owner
+
+#ifndef RANK_BY_SCAN
+board_t        *leaderboard;   // members by money (descending), then id
+#endif
+
+cdc_ring_t     *changes;        // NULL if changes are applied in place
+pthread_t       change_consumer;
+unsigned long   change_events;  // applied by the consumer (or in place)
 
-rb_node_t      *rank[RANK_MAX];
-rb_node_t      *zero_node;
-int             bound_id, bound_money;
+struct log_arena_s     log_arena;
+struct log_segments_s  log_segments;
 
-int a, b, c, d, e, f, g;
+struct query_in_s   query_in;
+struct result_out_s result_out;
 
 
 /* Main function */
 int main() {
     time_t stime = 0, etime = 0;
     float gap;
+    unsigned long hits, misses;
 
     stime = clock();
 
@@ -101,13 +290,13 @@ int main() {
     Setup();
     Execute();
 
-    printf("traverse calls                   :: %d\n", a);
-    printf("reset_bound calls                :: %d\n", b);
-    printf("ranked member buy                :: %d\n", c);
-    printf("ranked member add cash           :: %d\n", d);
-    printf("ranked member sell               :: %d\n", e);
-    printf("new member ranked by sell        :: %d\n", f);
-    printf("new member ranked in by add cash :: %d\n", g);
+    printf("leaderboard entries              :: %ld\n", board_count());
+    printf("balance changes streamed         :: %lu\n", change_events);
+
+    rb_cache_stats(all_members, &hits, &misses);
+    printf("lookup cache hits / misses       :: %lu / %lu\n", hits, misses);
+    printf("lookups rejected by filter       :: %lu\n", rb_filter_rejects(all_members));
+    printf("dense index active               :: %d\n", rb_dense_active(all_members));
 
     etime = clock();
 
@@ -123,65 +312,343 @@ int main() {
 /* Initiate global variables */
 void Init() {
     all_members = rb_create();
+    rb_cache_enable(all_members, CACHE_SLOTS);
+    rb_filter_enable(all_members, FILTER_KEYS, FILTER_FP_RATE, FILTER_BUDGET);
+    rb_dense_enable(all_members, DENSE_DENSITY);
     memset(area_owner, -1, 1001 * 1001 * sizeof(int));
 
-    zero_node = rb_create_node();
-    zero_node->value = (void*)create_member();
+    if ((area_grid = grid_create(1001)) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+
+    if ((members.hot = column_create()) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+    member_reserve(members.hot->cap);
+
+    if ((strings = intern_create()) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+
+#ifndef RANK_BY_SCAN
+    leaderboard = board_create();
+#endif
+
+    in_open();
 }
 
 /* Setup existing members from member-list file */
 int Setup() {
     char filename[1024];
-    FILE *input;
 
-    member_t *member;
-    rb_key_t id;
+    out_str("Input filename : ");
+    in_line(filename, 1024);
 
-    fputs("Input filename : ", stdout);
-    fgets(filename, 1024, stdin);
+    if (load_members(filename) == -1) {
+        // Prompt is still buffered
+        out_flush();
+        fputs("fopen() error\n", stderr);
+        exit(1);
+    }
 
-    filename[strlen(filename)-1] = 0;
+    grid_build(area_grid, &area_price[0][0], &area_owner[0][0]);
 
-    if ((input = fopen(filename, "r")) == NULL) {
-        fputs("fopen() error\n", stderr);
+    // Loaded members are ranked already, later changes go through the stream
+    change_start();
+
+    return 0;
+}
+
+/* Load the member-list file (mapped, parsed by several threads)
+ * returns the number of rows, -1 if the file can't be read */
+long load_members(const char *filename) {
+    load_part_t parts[LOAD_THREADS];
+    log_list_t *logs;
+    load_text_t *texts;
+    member_t   *cold;
+    struct stat st;
+    const char *data, *cut;
+    long rows, i, row, slot, at;
+    long base;
+    int fd, nparts, t, owner, x, y;
+
+    if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+
+    // Cut the file into parts at newlines
+    nparts = st.st_size / LOAD_MIN_PART + 1;
+    if (nparts > LOAD_THREADS) {
+        nparts = LOAD_THREADS;
+    }
+
+    for (t = 0; t < nparts; t++) {
+        parts[t].begin = (t == 0) ? data : parts[t-1].end;
+
+        if (t == nparts - 1) {
+            cut = data + st.st_size;
+        } else {
+            cut = data + st.st_size / nparts * (t + 1);
+            if (cut < parts[t].begin) {
+                cut = parts[t].begin;
+            }
+            if ((cut = memchr(cut, '\n', data + st.st_size - cut)) == NULL) {
+                cut = data + st.st_size;
+            } else {
+                cut++;
+            }
+        }
+        parts[t].end = cut;
+    }
+
+    // Count rows, then give each part its slots of the table
+    load_run(load_count, parts, nparts);
+
+    for (rows = 0, t = 0; t < nparts; t++) {
+        rows += parts[t].count;
+    }
+
+    base  = members.hot->count;
+    logs  = malloc(rows * sizeof(log_list_t));
+    texts = malloc(rows * sizeof(load_text_t));
+
+    if (logs == NULL || texts == NULL || column_reserve(members.hot, base + rows) == -1) {
+        fputs("malloc() error\n", stderr);
         exit(1);
     }
+    member_reserve(base + rows);
 
-    //
-    while (1) {
-        // 
-        member = create_member();
-        if ( fscanf(input, "%u %s %s %d %d %d %d",
-                &id, member->name, member->phone,
-                &member->x, &member->y, &member->level, &member->money) < 0 ) {
+    for (rows = 0, t = 0; t < nparts; t++) {
+        parts[t].base = base + rows;
+        parts[t].logs  = logs + rows;
+        parts[t].texts = texts + rows;
+        rows += parts[t].count;
+    }
+
+    load_run(load_parse, parts, nparts);
+
+    // Insert in file order, so the tree has the same shape as row by row
+    // (accepted rows move down over gaps and duplicates, logs live in one block)
+    // names are interned here, in file order as well
+    for (rows = 0, slot = base, t = 0; t < nparts; t++) {
+        for (i = 0; i < parts[t].count; i++) {
+            row  = parts[t].base + i;
+            cold = &members.cold[row];
+            x    = cold->x;
+            y    = cold->y;
+            at   = slot;
+
+            owner = area_owner[x][y];
+            area_owner[x][y] = members.hot->ids[row];
+
+            if (rb_insert(all_members, members.hot->ids[row], (void*)(intptr_t)slot) == 0) {
+                if (slot != row) {
+                    members.hot->ids[slot]   = members.hot->ids[row];
+                    members.hot->money[slot] = members.hot->money[row];
+                    members.level[slot]      = members.level[row];
+                    members.log[slot]        = members.log[row];
+                    members.cold[slot]       = *cold;
+                }
+                members.cold[slot].name  = intern_add(strings, texts[row - base].name,
+                    strlen(texts[row - base].name));
+                members.cold[slot].phone = phone_pack(texts[row - base].phone);
+
+                if (members.cold[slot].name == INTERN_NONE) {
+                    fputs("malloc() error\n", stderr);
+                    exit(1);
+                }
+
+                slot++;
+            } else {
+                // Duplicate row, the area goes to the member already loaded
+                at = member_slot(rb_get(all_members, members.hot->ids[row]));
+            }
+
+            // A later row starting on the area takes it over
+            if (owner != (int)members.hot->ids[at]) {
+                if (owner != -1) {
+                    cells_remove(member_slot(rb_get(all_members, owner)), x, y);
+                }
+                cells_add(at, x, y);
+            }
+        }
+        rows += parts[t].count;
+    }
+    members.hot->count = slot;
+
+    board_load(base, slot);
+
+    free(texts);
+    munmap((void*)data, st.st_size);
+
+    return rows;
+}
+
+/* Run the loading step over all parts, one thread each */
+void load_run(void *(*fn)(void *), load_part_t *parts, int nparts) {
+    pthread_t threads[LOAD_THREADS];
+    int t;
+
+    // The calling thread takes the first part
+    for (t = 1; t < nparts; t++) {
+        pthread_create(&threads[t], NULL, fn, &parts[t]);
+    }
+    fn(&parts[0]);
+    for (t = 1; t < nparts; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* Count lines of the part (upper bound of its rows) */
+void *load_count(void *arg) {
+    load_part_t *part = (load_part_t*)arg;
+    const char *p = part->begin;
+
+    part->count = 0;
+    while (p < part->end && (p = memchr(p, '\n', part->end - p)) != NULL) {
+        part->count++;
+        p++;
+    }
+
+    // Last line without newline
+    if (part->end > part->begin && part->end[-1] != '\n') {
+        part->count++;
+    }
+
+    return NULL;
+}
+
+/* Skip blanks (newlines included, as fscanf does) */
+const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+
+    return p;
+}
+
+/* Parse a decimal integer, NULL if there is none */
+const char *parse_int(const char *p, const char *end, long *value) {
+    int neg = 0;
+    long v = 0;
+
+    p = skip_space(p, end);
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p++ == '-');
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+
+    *value = neg ? -v : v;
+
+    return p;
+}
+
+/* Parse a word into the buffer (cut to fit), NULL if there is none */
+const char *parse_word(const char *p, const char *end, char *buf, int size) {
+    const char *word;
+    int len;
+
+    word = p = skip_space(p, end);
+
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    if (p == word) {
+        return NULL;
+    }
+
+    len = (p - word < size - 1) ? p - word : size - 1;
+    memcpy(buf, word, len);
+    buf[len] = 0;
+
+    return p;
+}
+
+/* Parse rows of the part into its members */
+void *load_parse(void *arg) {
+    load_part_t *part = (load_part_t*)arg;
+    const char  *p = part->begin, *end = part->end;
+    member_t    *member;
+    long id, x, y, level, money;
+    long n = 0;
+
+    while (n < part->count) {
+        member = &members.cold[part->base + n];
+        memset(member, 0, sizeof(member_t));
+
+        // Rows are "id name phone x y level money", an incomplete row ends the part
+        if ((p = parse_int(p, end, &id)) == NULL
+                || (p = parse_word(p, end, part->texts[n].name, NAME_SIZE)) == NULL
+                || (p = parse_word(p, end, part->texts[n].phone, PHONE_SIZE)) == NULL
+                || (p = parse_int(p, end, &x)) == NULL
+                || (p = parse_int(p, end, &y)) == NULL
+                || (p = parse_int(p, end, &level)) == NULL
+                || (p = parse_int(p, end, &money)) == NULL) {
             break;
         }
-        
-        rb_insert(all_members, id, (void*)member);
-        area_owner[member->x][member->y] = id;
+
+        member->x = x;
+        member->y = y;
+
+        part->logs[n].head = NULL;
+        part->logs[n].runs = NULL;
+        part->logs[n].hot  = 0;
+
+        members.log[part->base + n]        = &part->logs[n];
+        members.hot->ids[part->base + n]   = id;
+        members.hot->money[part->base + n] = money;
+        members.level[part->base + n]      = level;
+        n++;
     }
-    
-    delete_member(member);
-    fclose(input);
 
-    traverse_dfs(all_members); // set rank array
+    part->count = n;
 
-    return 0;
+    return NULL;
 }
 
 /* Execute queries */
 void Execute() {
-    char op;
+    int op;
     while (1) {
-        scanf("%c", &op);
+        // End of input quits as well
+        if ((op = in_char()) == EOF) {
+            op = 'Q';
+        }
         if (execute_operation(op) == EXIT_STATUS) {
             break;
         }
     }
+
+    change_stop();
+
+    out_flush();
 }
 
 /* Execute an operation (by translating a query) */
-int execute_operation(char op) {    
+int execute_operation(int op) {    
     switch (op) {
 
     case 'I' : // join
@@ -193,8 +660,11 @@ int execute_operation(char op) {
     case 'A' : // add
         op_add_cash();
         break;
-    case 'F' : // rank
-        op_find_top_five();
+    case 'F' : // top members
+        op_find_top();
+        break;
+    case 'K' : // rank
+        op_find_rank();
         break;
     case 'R' : // log
         op_print_log();
@@ -202,13 +672,30 @@ int execute_operation(char op) {
     case 'B' : // buy
         op_buy_area();
         break;
+    case 'S' : // total and average price of a region
+        op_area_sum();
+        break;
+    case 'C' : // owned areas of a region
+        op_area_owned();
+        break;
+    case 'X' : // most expensive area of a region
+        op_area_max();
+        break;
+    case 'L' : // owned areas of a member
+        op_list_cells();
+        break;
+    case 'N' : // number of owned areas of a member
+        op_count_cells();
+        break;
     case 'Q' : // exit
         return EXIT_STATUS;
     default :
-        printf("Invalid operation %c\n", op);
+        out_str("Invalid operation ");
+        out_char(op);
+        out_char('\n');
     }
 
-    getc(stdin); // to flush '\n' character
+    in_char(); // to flush '\n' character
 
     return CONTINUE;
 }
@@ -217,26 +704,50 @@ int execute_operation(char op) {
 void op_join_member() {
 
     rb_key_t id;
-    member_t *member;
+    member_t member;
+    char name[NAME_SIZE], phone[PHONE_SIZE];
+    long slot;
     int approval, depth;
 
-    member = create_member();
-    
-    scanf("%u %s %s %d %d",
-        &id, member->name, member->phone, &member->x, &member->y);
+    memset(&member, 0, sizeof(member_t));
+
+    id       = in_uint();
+    in_word(name, NAME_SIZE);
+    in_word(phone, PHONE_SIZE);
+    member.x = in_int();
+    member.y = in_int();
+
+    // Slot of the member if the id is new
+    slot = members.hot->count;
+
+    if ((approval = rb_insert(all_members, id, (void*)(intptr_t)slot)) == 0) {
+        member.phone = phone_pack(phone);
+
+        if ((member.name = intern_add(strings, name, strlen(name))) == INTERN_NONE) {
+            fputs("malloc() error\n", stderr);
+            exit(1);
+        }
+        member_add(id, &member, 0);
+        members.log[slot] = log_create();
+
+        change_publish(CDC_JOIN, id, slot, 0, UP, -1);
 
-    if ((approval = rb_insert(all_members, id, (void*)member)) == 0) {
         // If there is no owner in starting area, it becomes belonging of him(or her)
-        if (area_owner[member->x][member->y] == -1) {
-            area_owner[member->x][member->y] = id;
+        if (area_owner[member.x][member.y] == -1) {
+            area_owner[member.x][member.y] = id;
+            cells_add(slot, member.x, member.y);
+
+            grid_update(area_grid, member.x, member.y, area_price[member.x][member.y],
+                area_price[member.x][member.y], 0, 1);
         }
-    } else {
-        delete_member(member);
     }
     
     depth = rb_find(all_members, id, NULL);
 
-    printf("%d %d\n", depth, approval+1);
+    out_int(depth);
+    out_char(' ');
+    out_int(approval+1);
+    out_char('\n');
 }
 
 /* Print information of the member */
@@ -245,87 +756,185 @@ void op_print_info() {
     rb_key_t    id;
     int         depth;
     rb_node_t  *node;
-    member_t   *info;
+    long        slot;
+    char        phone[PHONE_DIGITS + 1];
 
-    scanf("%u", &id);
+    id = in_uint();
 
     if ((depth = rb_find(all_members, id, &node)) == -1) {
-        puts("Not found!");
+        out_str("Not found!\n");
 
     } else {            
-        info = (member_t*)node->value;
-        printf("%s %s %d %d %u\n",
-            info->name, info->phone, info->level, info->money, depth);
+        slot = member_slot(node);
+        out_str(intern_get(strings, members.cold[slot].name));
+        out_char(' ');
+        out_str(phone_unpack(members.cold[slot].phone, phone));
+        out_char(' ');
+        out_int(members.level[slot]);
+        out_char(' ');
+        out_int(members.hot->money[slot]);
+        out_char(' ');
+        out_int(depth);
+        out_char('\n');
     }
 }
 
 /* Set the level depending on current money */
-void set_level(member_t *member) {
+void set_level(long slot) {
+    int money = members.hot->money[slot];
 
-    if (member->money < 30000) {
-        member->level = 0;
+    if (money < 30000) {
+        members.level[slot] = 0;
 
-    } else if (member->money < 50000) {
-        member->level = 1;
+    } else if (money < 50000) {
+        members.level[slot] = 1;
 
-    } else if (member->money < 100000) {
-        member->level = 2;
+    } else if (money < 100000) {
+        members.level[slot] = 2;
 
     } else {
-        member->level = 3;
+        members.level[slot] = 3;
     } 
 }
 
-/* Do comparison node a with node b (compare money mainly, and then id) */
-int rank_cmp(rb_node_t *a, rb_node_t *b) {
-    int money_a, money_b;
+/* Rank the loaded members at once (the scan reads the member table as it is) */
+void board_load(long first, long last) {
+#ifndef RANK_BY_SCAN
+    if (board_build(leaderboard, members.hot->money, members.hot->ids, first, last) == -1) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+#else
+    (void)first;
+    (void)last;
+#endif
+}
 
-    money_a = ((member_t*)a->value)->money;
-    money_b = ((member_t*)b->value)->money;
+/* Rank a new member (the scan reads the member table as it is) */
+void board_join(rb_key_t id, long slot, int money) {
+#ifndef RANK_BY_SCAN
+    board_insert(leaderboard, money, id, (void*)(intptr_t)slot);
+#else
+    (void)id;
+    (void)slot;
+    (void)money;
+#endif
+}
 
-    // If a has money more than b, simply return 1
-    if (money_a > money_b) {
-        return 1;
+/* Move the member to its new money, keeping the leaderboard in order -> O(log n) */
+void board_renew(rb_key_t id, int old_money, int money) {
+#ifndef RANK_BY_SCAN
+    board_move(leaderboard, old_money, id, money);
+#else
+    (void)id;
+    (void)old_money;
+    (void)money;
+#endif
+}
 
-    // Else, check the id
-    } else if (money_a == money_b) {
+/* Get number of ranked members */
+long board_count() {
+#ifdef RANK_BY_SCAN
+    return members.hot->count;
+#else
+    return board_size(leaderboard);
+#endif
+}
 
-        // If id of a is smaller than of b, return 1
-        if (a->key < b->key) {
-            return 1;
-        }
+/* Change money and level of the member, publishing the change */
+void add_cash(rb_key_t id, long slot, int amount, int updown, int cell) {
+    members.hot->money[slot] += amount;
+    set_level(slot);
+
+    change_publish(CDC_CASH, id, slot, amount, updown, cell);
+}
+
+/* Start the consumer of balance changes (none on a single CPU) */
+void change_start() {
+    // The two threads would only take turns on one CPU, so apply in place
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        return;
     }
 
-    // 0 means that node b is preceding in order
-    return 0;
+    if ((changes = cdc_create(CHANGE_RING, CHANGE_SPIN)) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+
+    if (pthread_create(&change_consumer, NULL, change_consume, NULL) != 0) {
+        fputs("pthread_create() error\n", stderr);
+        exit(1);
+    }
 }
 
-/* If account of ranked member is changed, reset the boundary of money and id */
-void reset_bound() {
-    rb_node_t *node = rb_create_node();
-    node->value = (void*)create_member();
+/* Let the consumer apply every change, then stop it */
+void change_stop() {
+    if (changes == NULL) {
+        return;
+    }
 
-    ((member_t*)node->value)->money = bound_money;
-    node->key                       = bound_id;
+    cdc_close(changes);
+    pthread_join(change_consumer, NULL);
 
-    // If boundary should be increased
-    if (rank_cmp(rank[RANK_MAX-1], node)) {
-        bound_money = ((member_t*)rank[RANK_MAX-1]->value)->money;
-        bound_id    = rank[RANK_MAX-1]->key;
+    cdc_free(changes);
+}
 
-    // Else if top 5 ranked member has been under the boundary
-    } else if (rank_cmp(node, rank[4])) {
-        // Renew the rank array -> O(n) time
-        traverse_dfs(all_members);
+/* Wait until logs and leaderboard reflect every change so far */
+void change_wait() {
+    if (changes != NULL) {
+        cdc_drain(changes);
+    }
+}
 
-        bound_money = ((member_t*)rank[RANK_MAX-1]->value)->money;
-        bound_id    = rank[RANK_MAX-1]->key;
+/* Publish a change of the member (money and level are already renewed)
+ * the consumer never reads the member table, which may grow meanwhile */
+void change_publish(int kind, rb_key_t id, long slot, int delta, int updown, int cell) {
+    cdc_event_t event;
+
+    event.kind    = kind;
+    event.id      = id;
+    event.slot    = slot;
+    event.delta   = delta;
+    event.balance = members.hot->money[slot];
+    event.cell    = cell;
+    event.updown  = updown;
+    event.log     = (void*)members.log[slot];
+
+    if (changes == NULL) {
+        change_apply(&event);
+        change_events++;
+        return;
     }
-    
-    delete_member((member_t*)node->value);
-    free(node);
 
-    b++;
+    cdc_publish(changes, &event);
+}
+
+/* Consumer thread, applies changes in publishing order (sleeps while idle) */
+void *change_consume(void *arg) {
+    cdc_event_t *event;
+
+    (void)arg;
+
+    while (cdc_next(changes, &event)) {
+        change_apply(event);
+        cdc_release(changes);
+        change_events++;
+    }
+
+    return NULL;
+}
+
+/* Renew log and rank of the member by the change */
+void change_apply(cdc_event_t *event) {
+    if (event->kind == CDC_JOIN) {
+        board_join(event->id, event->slot, event->balance);
+        return;
+    }
+
+    log_insert((log_list_t*)event->log, event->updown,
+        (event->updown == UP) ? event->delta : -event->delta);
+
+    board_renew(event->id, event->balance - event->delta, event->balance);
 }
 
 /* Add cash to the account */
@@ -333,165 +942,171 @@ void op_add_cash() {
     rb_key_t    id;
     int         amount, depth;
     rb_node_t  *node;
-    member_t   *info;
-
-    int i;
+    long        slot;
 
-    scanf("%u %d", &id, &amount);
+    id     = in_uint();
+    amount = in_int();
 
     // If there is no node corresponding to given id
     if ((depth = rb_find(all_members, id, &node)) == -1) {
-        puts("Not found!");
+        out_str("Not found!\n");
 
     // Else, add cash
     } else {
-        info = (member_t*)node->value;
+        slot = member_slot(node);
 
-        // Add cash
-        info->money += amount;
+        // Add cash and reset level (log and rank follow through the stream)
+        add_cash(id, slot, amount, UP, -1);
 
-        // Reset level of the member
-        set_level(info);
-
-        // Append log
-        log_insert(info->log, UP, amount);
-
-        printf("%d %d\n", depth, info->level);
-
-        // Renew rank
-        if (info->is_ranked == 1) {
-            for(i = 0; i < RANK_MAX; i++) {
-                if (rank[i] == node) break;
-            }
-            for (; i > 0; i--) {
-                if (rank_cmp(node, rank[i-1])) {
-                    rank[i] = rank[i-1];
-                } else {
-                    break;
-                }
-            }
-            rank[i] = node;
-
-            d++;
-
-        } else {
-            if (rank_cmp(node, rank[RANK_MAX-1])) {
-                ((member_t*)rank[RANK_MAX-1]->value)->is_ranked = 0;
-                info->is_ranked = 1;
-
-                for (i = RANK_MAX-1; i > 0; i--) {
-                    if (rank_cmp(node, rank[i-1])) {
-                        rank[i] = rank[i-1];
-                    } else {
-                        break;
-                    }
-                }
-                rank[i] = node;
-                reset_bound();
-
-                g++;
-            }
-        }
+        out_int(depth);
+        out_char(' ');
+        out_int(members.level[slot]);
+        out_char('\n');
     }
 }
 
-/* Find ranked members by depth first traversal */
-void traverse_dfs(rb_tree_t *tree) {
-    // Flush the rank array
-    for (int i = 0; i < RANK_MAX; i++) {
-        rank[i] = zero_node;
+/* Print top K members (5 if no count is given, K is clamped to 1..size) */
+void op_find_top() {
+    long i, k = TOP_DEFAULT;
+    int c;
+
+    // Count is optional, so look for it only up to the end of the line
+    in_skip_blank();
+    if (((c = in_peek()) >= '0' && c <= '9') || c == '-') {
+        k = in_int();
+        in_skip_blank();
     }
 
-    // Do traversal
-    traverse_dfs_node(tree->root);
+    if (k < 1) {
+        k = 1;
+    }
+    if (k > (long)all_members->size) {
+        k = all_members->size;
+    }
 
-    // Set boundary
-    bound_id = rank[RANK_MAX-1]->key;
-    bound_money = ((member_t*)rank[RANK_MAX-1]->value)->money;
-    
-    a++;
-}
+    change_wait();
 
-/* Do a depth first traversal of node, maintaining rank array */
-void traverse_dfs_node(rb_node_t *node) {
-    member_t *info;
-    int i;
+#ifdef RANK_BY_SCAN
+    long stack[TOP_STACK], *slots = stack;
+    int n;
+    if (k > TOP_STACK && (slots = malloc(k * sizeof(long))) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
 
-    if (node == NULL) return;
+    // Members without money are not ranked
+    n = column_top_k(members.hot, (int)k, 0, slots);
 
-    // Do the left node first (smallest id gets in first)
-    traverse_dfs_node(node->left);
+    for (i = 0; i < n; i++) {
+        out_int((int)members.hot->ids[slots[i]]);
+        out_char(' ');
+        out_int(members.hot->money[slots[i]]);
+        out_char('\n');
+    }
 
-    // Compare with last of ranked member
-    info = (member_t*)node->value;
-    if (info->money > ((member_t*)rank[RANK_MAX-1]->value)->money) {
-        // Swap out
-        ((member_t*)rank[RANK_MAX-1]->value)->is_ranked = 0;
+    if (slots != stack) {
+        free(slots);
+    }
+#else
+    board_node_t *entry;
 
-        // Find vacant
-        for (i = RANK_MAX-1; i > 0; i--) {
-            if (((member_t*)rank[i-1]->value)->money < info->money) {
-                rank[i] = rank[i-1];
-            } else {
-                break;
-            }
-        }
+    // Members without money are not ranked
+    for (i = 0; i < k; i++) {
+        if ((entry = board_at(leaderboard, i)) == NULL || entry->money <= 0) break;
 
-        // Swap in
-        rank[i] = node;
-        info->is_ranked = 1;
+        out_int((int)entry->id);
+        out_char(' ');
+        out_int(entry->money);
+        out_char('\n');
     }
+#endif
 
-    // Do the right node last, (largest id treated last)
-    traverse_dfs_node(node->right);
+    if (i == 0) {
+        out_str("Not found!\n");
+    }
 }
 
-/* Print top 5 members */
-void op_find_top_five() {
-    int i;
+/* Print rank of the member and its money */
+void op_find_rank() {
+    rb_key_t    id;
+    rb_node_t  *node;
+    int         money;
 
-    // Print ranked member, directly access to ranked array
-    // Time complexity :: O(1)
-    for (i = 0; i < 5; i++) {
-        if (rank[i] == zero_node) break;
+    id = in_uint();
 
-        printf("%d %d\n", rank[i]->key, ((member_t*)rank[i]->value)->money);
+    if ((node = rb_get(all_members, id)) == NULL) {
+        out_str("Not found!\n");
+        return;
     }
 
-    if (i == 0) {
-        puts("Not found!");
-    }
+    money = members.hot->money[member_slot(node)];
+
+    change_wait();
+
+#ifdef RANK_BY_SCAN
+    out_int(column_rank(members.hot, id, money));
+#else
+    out_int(board_rank(leaderboard, money, id));
+#endif
+    out_char(' ');
+    out_int(money);
+    out_char('\n');
 }
 
 /* Print log of the account */
 void op_print_log() {
     rb_key_t    id;
     int         print_size;
-    rb_node_t  *node;
-    log_node_t *log;
-    
-    int i;
+    rb_node_t   *node;
+    log_list_t  *list;
+    log_chunk_t *chunk;
+    log_run_t   *run;
+    log_entry_t *log;
 
-    scanf("%u %d", &id, &print_size);
+    static log_entry_t spilled[LOG_RUN_MAX];
+
+    int i, j;
+
+    id         = in_uint();
+    print_size = in_int();
 
     // If there is no node corresponding to given id
-    if (rb_find(all_members, id, &node) == -1) {
-        puts("Not found!");
+    if ((node = rb_get(all_members, id)) == NULL) {
+        out_str("Not found!\n");
         return;
     }
 
-    // Print logs
-    log = ((member_t*)node->value)->log->head;
-    for (i = 0; i < print_size; i++) {
-        if (log == NULL) break;
+    change_wait();
 
-        printf("%d %d\n", log->updown, log->amount);        
-        log = log->next;
+    // Print logs, newest first (each chunk read backwards)
+    list  = members.log[member_slot(node)];
+    chunk = list->head;
+    for (i = 0; chunk != NULL && i < print_size; chunk = chunk->next) {
+        for (j = chunk->count - 1; j >= 0 && i < print_size; j--, i++) {
+            log = &chunk->entries[j];
+
+            out_int(log->updown);
+            out_char(' ');
+            out_int(log->amount);
+            out_char('\n');
+        }
+    }
+
+    // Then older ones from the segment files
+    for (run = list->runs; run != NULL && i < print_size; run = run->next) {
+        log_read_run(run, spilled);
+
+        for (j = run->count - 1; j >= 0 && i < print_size; j--, i++) {
+            out_int(spilled[j].updown);
+            out_char(' ');
+            out_int(spilled[j].amount);
+            out_char('\n');
+        }
     }
 
     // Case of no log
     if (i == 0) {
-        puts("0");
+        out_str("0\n");
     }
 }
 
@@ -500,115 +1115,364 @@ void op_buy_area() {
     rb_key_t    id;
     int         x, y, spent;
 
-    rb_node_t  *node, *origin;
-    member_t   *info;
+    rb_node_t  *node;
+    long        slot, origin;
     int         approval;
 
-    int i;
-
-    scanf("%u %d %d %d", &id, &x, &y, &spent); 
+    id    = in_uint();
+    x     = in_int();
+    y     = in_int();
+    spent = in_int();
 
     // If there is no node corresponding to the given id
-    if (rb_find(all_members, id, &node) == -1) {
-        puts("Not found!");
+    if ((node = rb_get(all_members, id)) == NULL) {
+        out_str("Not found!\n");
         return;
     }
 
     approval = 0;
-    info = (member_t*)node->value;
+    slot = member_slot(node);
 
     // Do purchase only when it's area of others
-    if (id != area_owner[x][y]) {
+    if ((int)id != area_owner[x][y]) {
 
         // The member should pay affordable price
         // and current account(money) of the member should be enough to pay it over
-        if (spent >= area_price[x][y] && info->money >= spent) {
+        if (spent >= area_price[x][y] && members.hot->money[slot] >= spent) {
             // Set approval flag to 1
             approval = 1;
 
             // Case of trade
             if (area_owner[x][y] != -1) {
                 // Find the owner of the area
-                rb_find(all_members, area_owner[x][y], &origin);
-                
-                info = (member_t*)origin->value;
-
-                // Add cash
-                info->money += spent;
-                set_level(info);
-                log_insert(info->log, UP, spent);
-
-                // Renew the ranked array
-                if (info->is_ranked == 1) {
-                    for (i = 0; i < RANK_MAX; i++) {
-                        if (rank[i] == origin) break;
-                    }
-                    for (; i > 0; i--) {
-                        if (rank_cmp(origin, rank[i-1])) {
-                            rank[i] = rank[i-1];
-                        } else {
-                            break;
-                        }
-                    }
-                    rank[i] = origin;
-                    e++;
-
-                } else {
-                    if (rank_cmp(origin, rank[RANK_MAX-1])) {
-                        ((member_t*)rank[RANK_MAX-1]->value)->is_ranked = 0;
-                        info->is_ranked = 1;
-
-                        for (i = RANK_MAX-1; i > 0; i--) {
-                            if (rank_cmp(origin, rank[i-1])) {
-                                rank[i] = rank[i-1];
-                            } else {
-                                break;
-                            }
-                        }
-                        rank[i] = origin;
-                        reset_bound();
-
-                        f++;
-                    }
-                }
+                origin = member_slot(rb_get(all_members, area_owner[x][y]));
+                cells_remove(origin, x, y);
+
+                // Add cash (renews rank)
+                add_cash(area_owner[x][y], origin, spent, UP, x * 1001 + y);
             }
 
-            // Proceed the purchase
-            info = (member_t*)node->value;
+            // Decrease the money of account (renews rank)
+            add_cash(id, slot, -spent, DOWN, x * 1001 + y);
 
-            // Decrease the money of account
-            info->money -= spent;
-            set_level(info);
-            log_insert(info->log, DOWN, spent);
+            // Renew area info
+            grid_update(area_grid, x, y, area_price[x][y], spent, area_owner[x][y] != -1, 1);
 
-            // Renew the ranked array
-            // There is no need to doubt to getting in a new node to ranked array
-            if (info->is_ranked == 1) {
-                for (i = 0; i < RANK_MAX; i++) {
-                    if (rank[i] == node) break;
-                }
+            area_price[x][y] = spent;
+            area_owner[x][y] = id;
+            cells_add(slot, x, y);
+        }
+    }
 
-                for (; i < RANK_MAX-1; i++) {
-                    if (rank_cmp(rank[i+1], node)) {
-                        rank[i] = rank[i+1];
-                    } else {
-                        break;
-                    }
-                }
-                rank[i] = node;
+    out_int(approval);
+    out_char(' ');
+    out_int(members.hot->money[slot]);
+    out_char(' ');
+    out_int(area_owner[x][y]);
+    out_char('\n');
+}
+
+/* Print owned areas of the member (count, then "x y" per area) */
+void op_list_cells() {
+    rb_key_t    id;
+    rb_node_t  *node;
+    member_t   *info;
+    int         i;
 
-                reset_bound();
+    id = in_uint();
 
-                c++;
-            }
+    if ((node = rb_get(all_members, id)) == NULL) {
+        out_str("Not found!\n");
+        return;
+    }
 
-            // Renew area info
-            area_price[x][y] = spent;
-            area_owner[x][y] = id;
+    info = &members.cold[member_slot(node)];
+
+    out_int(info->ncells);
+    out_char('\n');
+
+    for (i = 0; i < info->ncells; i++) {
+        out_int(info->cells[i] / 1001);
+        out_char(' ');
+        out_int(info->cells[i] % 1001);
+        out_char('\n');
+    }
+}
+
+/* Print number of owned areas of the member */
+void op_count_cells() {
+    rb_key_t    id;
+    rb_node_t  *node;
+
+    id = in_uint();
+
+    if ((node = rb_get(all_members, id)) == NULL) {
+        out_str("Not found!\n");
+        return;
+    }
+
+    out_int(members.cold[member_slot(node)].ncells);
+    out_char('\n');
+}
+
+/* Print total and average price of the areas in a region */
+void op_area_sum() {
+    int x1, y1, x2, y2;
+    long long total;
+    char buf[32];
+
+    in_area(&x1, &y1, &x2, &y2);
+
+    // Aggregates are built by the first region query
+    if ((total = grid_sum(area_grid, x1, y1, x2, y2)) == -1) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+    snprintf(buf, sizeof(buf), " %.2f\n",
+        (double)total / ((long)(x2 - x1 + 1) * (y2 - y1 + 1)));
+
+    out_int(total);
+    out_str(buf);
+}
+
+/* Print number of owned areas in a region */
+void op_area_owned() {
+    int x1, y1, x2, y2;
+    long owned;
+
+    in_area(&x1, &y1, &x2, &y2);
+
+    if ((owned = grid_owned(area_grid, x1, y1, x2, y2)) == -1) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+
+    out_int(owned);
+    out_char('\n');
+}
+
+/* Print the most expensive area of a region (price, then its position) */
+void op_area_max() {
+    int x1, y1, x2, y2, x, y, price;
+
+    in_area(&x1, &y1, &x2, &y2);
+
+    if ((price = grid_max(area_grid, x1, y1, x2, y2, &x, &y)) == -1) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+
+    out_int(price);
+    out_char(' ');
+    out_int(x);
+    out_char(' ');
+    out_int(y);
+    out_char('\n');
+}
+
+/* Open the queries on stdin (mapped if it is a file, else read in blocks) */
+void in_open() {
+    struct stat st;
+    off_t start;
+
+    memset(&query_in, 0, sizeof(query_in));
+
+    if (fstat(0, &st) == 0 && S_ISREG(st.st_mode)
+            && (start = lseek(0, 0, SEEK_CUR)) != -1 && start < st.st_size) {
+        query_in.buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+
+        if (query_in.buf != MAP_FAILED) {
+            madvise(query_in.buf, st.st_size, MADV_SEQUENTIAL);
+            query_in.mapped = 1;
+            query_in.pos    = start;
+            query_in.len    = st.st_size;
+            return;
+        }
+    }
+
+    if ((query_in.buf = malloc(QUERY_BLOCK)) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+}
+
+/* Look at the next input character without taking it (EOF at the end) */
+int in_peek() {
+    ssize_t n;
+
+    if (query_in.pos == query_in.len) {
+        if (query_in.mapped || query_in.eof) {
+            return EOF;
+        }
+
+        if ((n = read(0, query_in.buf, QUERY_BLOCK)) <= 0) {
+            query_in.eof = 1;
+            return EOF;
+        }
+        query_in.pos = 0;
+        query_in.len = n;
+    }
+
+    return (unsigned char)query_in.buf[query_in.pos];
+}
+
+/* Take the next input character */
+int in_char() {
+    int c = in_peek();
+
+    if (c != EOF) {
+        query_in.pos++;
+    }
+
+    return c;
+}
+
+/* Skip blanks before a field (as scanf does) */
+void in_skip_space() {
+    int c;
+
+    while ((c = in_peek()) == ' ' || c == '\n' || c == '\t' || c == '\r') {
+        query_in.pos++;
+    }
+}
+
+/* Skip blanks within the line (stops at '\n') */
+void in_skip_blank() {
+    int c;
+
+    while ((c = in_peek()) == ' ' || c == '\t' || c == '\r') {
+        query_in.pos++;
+    }
+}
+
+/* Take an unsigned decimal */
+unsigned in_uint() {
+    unsigned value = 0;
+    int c;
+
+    in_skip_space();
+    while ((c = in_peek()) >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        query_in.pos++;
+    }
+
+    return value;
+}
+
+/* Take a signed decimal */
+int in_int() {
+    int neg = 0;
+
+    in_skip_space();
+    if (in_peek() == '-') {
+        neg = 1;
+        query_in.pos++;
+    }
+
+    return neg ? -(int)in_uint() : (int)in_uint();
+}
+
+/* Take a word (cut to fit the buffer) */
+void in_word(char *buf, int size) {
+    int len = 0, c;
+
+    in_skip_space();
+    while ((c = in_peek()) != EOF && c != ' ' && c != '\n' && c != '\t' && c != '\r') {
+        if (len < size - 1) {
+            buf[len++] = c;
+        }
+        query_in.pos++;
+    }
+
+    buf[len] = 0;
+}
+
+/* Take the rest of the line, without its newline */
+void in_line(char *buf, int size) {
+    int len = 0, c;
+
+    while ((c = in_char()) != EOF && c != '\n') {
+        if (len < size - 1) {
+            buf[len++] = c;
+        }
+    }
+
+    buf[len] = 0;
+}
+
+/* Take two corners of a region, ordered and clamped to the area grid */
+void in_area(int *x1, int *y1, int *x2, int *y2) {
+    int c[4], i, t;
+
+    for (i = 0; i < 4; i++) {
+        c[i] = in_int();
+        c[i] = (c[i] < 0) ? 0 : (c[i] > 1000) ? 1000 : c[i];
+    }
+
+    if (c[0] > c[2]) { t = c[0]; c[0] = c[2]; c[2] = t; }
+    if (c[1] > c[3]) { t = c[1]; c[1] = c[3]; c[3] = t; }
+
+    *x1 = c[0]; *y1 = c[1];
+    *x2 = c[2]; *y2 = c[3];
+}
+
+/* Write out the buffered results */
+void out_flush() {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < result_out.len) {
+        if ((n = write(1, result_out.buf + done, result_out.len - done)) <= 0) {
+            break;
         }
+        done += n;
+    }
+
+    result_out.len = 0;
+}
+
+/* Append a string to the results */
+void out_str(const char *str) {
+    size_t len = strlen(str);
+
+    if (result_out.len + len > RESULT_BUFFER) {
+        out_flush();
+    }
+
+    memcpy(result_out.buf + result_out.len, str, len);
+    result_out.len += len;
+}
+
+/* Append a decimal to the results */
+void out_int(long value) {
+    char digits[24];
+    int len = 0;
+    unsigned long v = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+    if (result_out.len + sizeof(digits) > RESULT_BUFFER) {
+        out_flush();
+    }
+
+    do {
+        digits[len++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+
+    if (value < 0) {
+        result_out.buf[result_out.len++] = '-';
+    }
+    while (len > 0) {
+        result_out.buf[result_out.len++] = digits[--len];
+    }
+}
+
+/* Append a character to the results */
+void out_char(char c) {
+    if (result_out.len == RESULT_BUFFER) {
+        out_flush();
     }
 
-    printf("%d %d %d\n", approval, info->money, area_owner[x][y]);
+    result_out.buf[result_out.len++] = c;
 }
 
 /* Create log list */
@@ -620,67 +1484,338 @@ log_list_t *log_create() {
     }
 
     list->head = NULL;
+    list->runs = NULL;
+    list->hot  = 0;
 
     return list;
 }
 
-/* Create log node */
-log_node_t *log_create_node() {
-    log_node_t *node = NULL;
+/* Create log chunk of the size class (from the arena) */
+log_chunk_t *log_create_chunk(int cls) {
+    log_chunk_t *chunk;
+    size_t size = sizeof(log_chunk_t) + (LOG_CHUNK_MIN << cls) * sizeof(log_entry_t);
+    char *block;
 
-    if ((node = malloc(sizeof(log_node_t))) == NULL) {
-        return NULL;
+    if ((chunk = log_arena.free[cls]) != NULL) {
+        log_arena.free[cls] = chunk->next;
+
+    } else {
+        // Start a new block (the first word links the previous one)
+        if (log_arena.block == NULL || log_arena.used + size > LOG_ARENA_BLOCK) {
+            if ((block = malloc(LOG_ARENA_BLOCK)) == NULL) {
+                return NULL;
+            }
+            *(char**)block   = log_arena.block;
+            log_arena.block  = block;
+            log_arena.used   = sizeof(char*);
+        }
+
+        chunk = (log_chunk_t*)(log_arena.block + log_arena.used);
+        log_arena.used += size;
     }
 
-    node->next   = NULL;
-    node->updown = 0;
-    node->amount = 0;
+    chunk->next  = NULL;
+    chunk->count = 0;
+    chunk->cls   = cls;
 
-    return node;
+    return chunk;
 }
 
-/* Delete log list */
-void log_delete(log_list_t *list) {
-    log_node_t *log, *tmp;
+/* Insert log to list (a bigger chunk when the newest one is full)
+ * older chunks are spilled to a segment file first if LOG_HOT_MAX entries are
+ * in memory, so no more than that stay there (unless spilling has failed) */
+void log_insert(log_list_t *list, int ud, int amt) {
+    log_chunk_t *chunk;
+    int cls = 0;
 
-    log = list->head;
-    while (log != NULL) {
-        tmp = log->next;
-        free(log);
-        log = tmp;
+    if (list->hot >= LOG_HOT_MAX && !log_segments.failed && log_spill(list) == -1) {
+        fputs("log spill error, logs are kept in memory\n", stderr);
+        log_segments.failed = 1;
     }
 
-    free(list);
+    chunk = list->head;
+    if (chunk == NULL || chunk->count == (LOG_CHUNK_MIN << chunk->cls)) {
+        if (chunk != NULL) {
+            cls = (chunk->cls + 1 < LOG_CLASSES) ? chunk->cls + 1 : chunk->cls;
+        }
+
+        if ((chunk = log_create_chunk(cls)) == NULL) {
+            fputs("malloc() error\n", stderr);
+            exit(1);
+        }
+
+        chunk->next = list->head;
+        list->head  = chunk;
+    }
+
+    chunk->entries[chunk->count].updown = ud;
+    chunk->entries[chunk->count].amount = amt;
+    chunk->count++;
+    list->hot++;
 }
 
-/* Insert log to list */
-void log_insert(log_list_t *list, int ud, int amt) {
-    log_node_t *node;
+/* Move the older chunks of the list to a new run at the end of the segment files
+ * newest chunks holding at least LOG_HOT_KEEP entries stay, as R reads them first
+ * each entry is one varint: zigzag amount delta from the older entry, then updown bit
+ * -1 if the run can't be stored (the list is left as it was) */
+int log_spill(log_list_t *list) {
+    static log_entry_t entries[LOG_RUN_MAX];
+    static unsigned char buf[LOG_RUN_MAX * 6];
+
+    log_chunk_t *chunk, *older, *last;
+    log_run_t *run;
+    unsigned long v;
+    long prev = 0, delta;
+    char *dst;
+    int i, n, kept;
+    size_t len = 0;
+
+    // Oldest chunk that stays in memory
+    for (last = list->head, kept = last->count;
+            kept < LOG_HOT_KEEP && last->next != NULL; kept += last->count) {
+        last = last->next;
+    }
+    if (last->next == NULL) {
+        // Nothing older to spill
+        return 0;
+    }
+    n = list->hot - kept;
+
+    // Chunks are newest first, entries of a chunk oldest first
+    for (chunk = last->next; chunk != NULL; chunk = chunk->next) {
+        n -= chunk->count;
+        memcpy(entries + n, chunk->entries, chunk->count * sizeof(log_entry_t));
+    }
+
+    for (i = 0; i < list->hot - kept; i++) {
+        delta = (long)entries[i].amount - prev;
+        prev  = entries[i].amount;
+
+        v = (((unsigned long)delta << 1) ^ (unsigned long)(delta >> 63)) << 1 | (entries[i].updown & 1);
+        for (; v >= 0x80; v >>= 7) {
+            buf[len++] = (unsigned char)(v | 0x80);
+        }
+        buf[len++] = (unsigned char)v;
+    }
+
+    if ((run = malloc(sizeof(log_run_t))) == NULL) {
+        return -1;
+    }
+    if ((dst = log_segment_reserve(len, &run->segment, &run->offset)) == NULL) {
+        free(run);
+        return -1;
+    }
+    memcpy(dst, buf, len);
 
-    node = log_create_node();
-    node->updown = ud;
-    node->amount = amt;
+    run->count = list->hot - kept;
+    run->next  = list->runs;
+    list->runs = run;
 
-    node->next = list->head;
-    list->head = node;
+    // Spilled chunks go back to the arena
+    for (chunk = last->next; chunk != NULL; chunk = older) {
+        older = chunk->next;
+
+        chunk->next = log_arena.free[chunk->cls];
+        log_arena.free[chunk->cls] = chunk;
+    }
+
+    last->next = NULL;
+    list->hot  = kept;
+
+    return 0;
 }
 
-/* Create member */
-member_t *create_member() {
-    member_t *member;
-    
-    if ((member = malloc(sizeof(member_t))) == NULL) {
-        return NULL;
+/* Get room for size bytes at the end of the segment files (a new file when full) */
+char *log_segment_reserve(size_t size, int *segment, unsigned int *offset) {
+    char path[4096], **maps, *map;
+    const char *dir;
+    int fd, cap;
+
+    if (log_segments.count == 0 || log_segments.used + size > LOG_SEGMENT_SIZE) {
+        if (log_segments.count == log_segments.cap) {
+            cap = log_segments.cap ? 2 * log_segments.cap : 16;
+            if ((maps = realloc(log_segments.maps, cap * sizeof(char*))) == NULL) {
+                return NULL;
+            }
+            log_segments.maps = maps;
+            log_segments.cap  = cap;
+        }
+
+        // File is unlinked once mapped, pages stay backed by it (and go with the process)
+        if ((dir = getenv("TMPDIR")) == NULL || *dir == '\0') {
+            dir = LOG_SEGMENT_DIR;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s.%d.%d", dir, LOG_SEGMENT_NAME,
+                (int)getpid(), log_segments.count) >= (int)sizeof(path)) {
+            return NULL;
+        }
+        if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1) {
+            return NULL;
+        }
+        if (ftruncate(fd, LOG_SEGMENT_SIZE) == -1
+                || (map = mmap(NULL, LOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            close(fd);
+            unlink(path);
+            return NULL;
+        }
+        close(fd);
+        unlink(path);
+
+        log_segments.maps[log_segments.count++] = map;
+        log_segments.used = 0;
+    }
+
+    *segment = log_segments.count - 1;
+    *offset  = log_segments.used;
+    log_segments.used += size;
+
+    return log_segments.maps[*segment] + *offset;
+}
+
+/* Decode a spilled run, oldest entry first, returning the number of entries */
+int log_read_run(log_run_t *run, log_entry_t *entries) {
+    const unsigned char *p;
+    unsigned long v;
+    long prev = 0;
+    int i, shift;
+
+    p = (const unsigned char*)log_segments.maps[run->segment] + run->offset;
+
+    for (i = 0; i < run->count; i++) {
+        for (v = 0, shift = 0; *p & 0x80; p++, shift += 7) {
+            v |= (unsigned long)(*p & 0x7f) << shift;
+        }
+        v |= (unsigned long)*p++ << shift;
+
+        entries[i].updown = v & 1;
+        v >>= 1;
+        prev += (long)(v >> 1) ^ -(long)(v & 1);
+        entries[i].amount = (int)prev;
+    }
+
+    return run->count;
+}
+
+/* Add the area to the owned ones of the member -> O(1) amortized */
+void cells_add(long slot, int x, int y) {
+    member_t *member = &members.cold[slot];
+    int *cells;
+
+    if (member->ncells == member->cells_cap) {
+        member->cells_cap = member->cells_cap ? 2 * member->cells_cap : 1;
+        if ((cells = realloc(member->cells, member->cells_cap * sizeof(int))) == NULL) {
+            fputs("malloc() error\n", stderr);
+            exit(1);
+        }
+        member->cells = cells;
+    }
+
+    member->cells[member->ncells++] = x * 1001 + y;
+}
+
+/* Remove the area from the owned ones of the member (last one fills its place)
+ * -> O(cells owned) */
+void cells_remove(long slot, int x, int y) {
+    member_t *member = &members.cold[slot];
+    int pos;
+
+    for (pos = 0; pos < member->ncells && member->cells[pos] != x * 1001 + y; pos++);
+
+    if (pos < member->ncells) {
+        member->cells[pos] = member->cells[--member->ncells];
+    }
+}
+
+/* Make room for cap slots in the member table (hot arrays are grown by the column) */
+void member_reserve(long cap) {
+    unsigned char *level;
+    log_list_t **log;
+    member_t *cold;
+
+    if (cap <= members.cap) {
+        return;
+    }
+
+    if ((level = realloc(members.level, cap)) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+    members.level = level;
+
+    if ((log = realloc(members.log, cap * sizeof(log_list_t*))) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
     }
+    members.log = log;
 
-    memset(member, 0, sizeof(member_t));
-    member->log = log_create();
+    if ((cold = realloc(members.cold, cap * sizeof(member_t))) == NULL) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+    members.cold = cold;
+
+    members.cap = cap;
+}
+
+/* Append a member to the table, returning its slot */
+long member_add(rb_key_t id, member_t *cold, int money) {
+    long slot;
+
+    if ((slot = column_add(members.hot, id, money)) == -1) {
+        fputs("malloc() error\n", stderr);
+        exit(1);
+    }
+    member_reserve(members.hot->cap);
+
+    members.cold[slot] = *cold;
+    set_level(slot);
+
+    return slot;
+}
 
-    return member;
+/* Get slot of the member from its tree node */
+long member_slot(rb_node_t *node) {
+    return (long)(intptr_t)node->value;
 }
 
-/* Delete member */
-void delete_member(member_t *member) {
-    log_delete(member->log);
-    free(member);
+/* Pack a phone into 64 bits (length in the low 4 bits, then a digit per 4 bits)
+ * a phone that isn't only digits goes to the string pool */
+uint64_t phone_pack(const char *phone) {
+    uint64_t packed = 0;
+    unsigned int id;
+    int len = strlen(phone), i;
+
+    for (i = 0; i < len && phone[i] >= '0' && phone[i] <= '9'; i++);
+
+    if (i < len || len > PHONE_DIGITS) {
+        if ((id = intern_add(strings, phone, len)) == INTERN_NONE) {
+            fputs("malloc() error\n", stderr);
+            exit(1);
+        }
+        return PHONE_INTERNED | id;
+    }
+
+    for (i = len - 1; i >= 0; i--) {
+        packed = (packed << 4) | (uint64_t)(phone[i] - '0');
+    }
+
+    return (packed << 4) | (uint64_t)len;
+}
+
+/* Get the phone back as a string (buf holds PHONE_DIGITS + 1 bytes) */
+const char *phone_unpack(uint64_t phone, char *buf) {
+    int len, i;
+
+    if (phone & PHONE_INTERNED) {
+        return intern_get(strings, (unsigned int)phone);
+    }
+
+    len = phone & 0xf;
+    for (i = 0, phone >>= 4; i < len; i++, phone >>= 4) {
+        buf[i] = '0' + (phone & 0xf);
+    }
+    buf[len] = '\0';
+
+    return buf;
 }
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+#define CELL_BITS   20      // cells of the grid fit below (n * n <= 1 << 20)
+#define CELL_MASK   ((1LL << CELL_BITS) - 1)
+
+/* Get max tree key of the cell, ties go to the smaller cell index */
+static long long max_key(grid_t *grid, int x, int y, int price) {
+    return ((long long)price << CELL_BITS) | (CELL_MASK - (x * grid->n + y));
+}
+
+/* Create grid over n x n cells, all priced 0 and not owned
+ * aggregates are built on the first query that needs them */
+grid_t *grid_create(int n) {
+    grid_t *grid;
+
+    if ((long long)n * n > CELL_MASK || (grid = malloc(sizeof(grid_t))) == NULL) {
+        return NULL;
+    }
+
+    memset(grid, 0, sizeof(grid_t));
+    grid->n = n;
+
+    return grid;
+}
+
+/* Drop the aggregates, they are built again from the cells when queried */
+static void grid_reset(grid_t *grid) {
+    free(grid->price_sum);
+    free(grid->owned);
+    free(grid->max);
+
+    grid->price_sum = NULL;
+    grid->owned     = NULL;
+    grid->max       = NULL;
+}
+
+/* Take row-major cells (owner -1 if not owned) the aggregates are built from -> O(1)
+ * the caller keeps the arrays current, and reports each change by grid_update */
+void grid_build(grid_t *grid, const int *price, const int *owner) {
+    grid->price = price;
+    grid->owner = owner;
+
+    grid_reset(grid);
+}
+
+/* Build the Fenwick trees of sums and owned counts from the cells -> O(n^2) */
+static int sums_build(grid_t *grid) {
+    int n = grid->n, x, y, i, p;
+
+    grid->price_sum = malloc((size_t)(n + 1) * (n + 1) * sizeof(long long));
+    grid->owned     = malloc((size_t)(n + 1) * (n + 1) * sizeof(int));
+
+    if (grid->price_sum == NULL || grid->owned == NULL) {
+        grid_reset(grid);
+        return -1;
+    }
+
+    for (x = 0; x <= n; x++) {
+        for (y = 0; y <= n; y++) {
+            i = x * (n + 1) + y;
+
+            grid->price_sum[i] = (grid->price != NULL && x > 0 && y > 0)
+                ? grid->price[(x - 1) * n + y - 1] : 0;
+            grid->owned[i]     = (grid->owner != NULL && x > 0 && y > 0)
+                ? grid->owner[(x - 1) * n + y - 1] != -1 : 0;
+        }
+    }
+
+    // Fenwick in linear time, rows then columns push to their parents
+    for (x = 1; x <= n; x++) {
+        for (y = 1; y <= n; y++) {
+            if ((p = y + (y & -y)) <= n) {
+                grid->price_sum[x * (n + 1) + p] += grid->price_sum[x * (n + 1) + y];
+                grid->owned[x * (n + 1) + p]     += grid->owned[x * (n + 1) + y];
+            }
+        }
+    }
+    for (x = 1; x <= n; x++) {
+        if ((p = x + (x & -x)) <= n) {
+            for (y = 1; y <= n; y++) {
+                grid->price_sum[p * (n + 1) + y] += grid->price_sum[x * (n + 1) + y];
+                grid->owned[p * (n + 1) + y]     += grid->owned[x * (n + 1) + y];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Build the 2D max segment tree from the cells -> O(n^2) */
+static int max_build(grid_t *grid) {
+    int n = grid->n, w = 2 * n, x, y, i, j;
+    long long *max;
+
+    if ((max = grid->max = malloc((size_t)4 * n * n * sizeof(long long))) == NULL) {
+        return -1;
+    }
+
+    for (x = 0; x < n; x++) {
+        for (y = 0; y < n; y++) {
+            max[(size_t)(x + n) * w + y + n] =
+                max_key(grid, x, y, (grid->price != NULL) ? grid->price[x * n + y] : 0);
+        }
+    }
+
+    // Inner nodes of leaf rows, then inner rows
+    for (i = n; i < w; i++) {
+        for (j = n - 1; j > 0; j--) {
+            max[(size_t)i * w + j] = max[(size_t)i * w + 2 * j] > max[(size_t)i * w + 2 * j + 1]
+                ? max[(size_t)i * w + 2 * j] : max[(size_t)i * w + 2 * j + 1];
+        }
+    }
+    for (i = n - 1; i > 0; i--) {
+        for (j = 1; j < w; j++) {
+            max[(size_t)i * w + j] = max[(size_t)2 * i * w + j] > max[(size_t)(2 * i + 1) * w + j]
+                ? max[(size_t)2 * i * w + j] : max[(size_t)(2 * i + 1) * w + j];
+        }
+    }
+
+    return 0;
+}
+
+/* Renew price and owned flag of the cell -> O(log^2 n) per built aggregate, O(1) if none */
+void grid_update(grid_t *grid, int x, int y, int old_price, int price, int old_owned, int owned) {
+    int n = grid->n, w = 2 * n, i, j, k;
+    long long *max = grid->max, a, b;
+
+    if (grid->price_sum != NULL) {
+        for (i = x + 1; i <= n; i += i & -i) {
+            for (j = y + 1; j <= n; j += j & -j) {
+                grid->price_sum[i * (n + 1) + j] += price - old_price;
+                grid->owned[i * (n + 1) + j]     += owned - old_owned;
+            }
+        }
+    }
+
+    if (max == NULL) {
+        return;
+    }
+
+    // Leaf row first, then every row above it along the same columns
+    for (i = x + n; i > 0; i >>= 1) {
+        for (j = y + n; j > 0; j >>= 1) {
+            if (i >= n && j >= n) {
+                max[(size_t)i * w + j] = max_key(grid, x, y, price);
+                continue;
+            }
+
+            k = (i >= n) ? 0 : 1;
+            a = k ? max[(size_t)2 * i * w + j] : max[(size_t)i * w + 2 * j];
+            b = k ? max[(size_t)(2 * i + 1) * w + j] : max[(size_t)i * w + 2 * j + 1];
+
+            max[(size_t)i * w + j] = (a > b) ? a : b;
+        }
+    }
+}
+
+/* Get Fenwick prefix sums of the cells [0, x) x [0, y) */
+static long long prefix_sum(grid_t *grid, int x, int y, long *owned) {
+    long long sum = 0;
+    int n = grid->n, i, j;
+
+    *owned = 0;
+    for (i = x; i > 0; i -= i & -i) {
+        for (j = y; j > 0; j -= j & -j) {
+            sum    += grid->price_sum[i * (n + 1) + j];
+            *owned += grid->owned[i * (n + 1) + j];
+        }
+    }
+
+    return sum;
+}
+
+/* Get total price of the cells [x1, x2] x [y1, y2] (-1 if out of memory) */
+long long grid_sum(grid_t *grid, int x1, int y1, int x2, int y2) {
+    long o;
+
+    if (grid->price_sum == NULL && sums_build(grid) == -1) {
+        return -1;
+    }
+
+    return prefix_sum(grid, x2 + 1, y2 + 1, &o) - prefix_sum(grid, x1, y2 + 1, &o)
+         - prefix_sum(grid, x2 + 1, y1, &o) + prefix_sum(grid, x1, y1, &o);
+}
+
+/* Get number of owned cells in [x1, x2] x [y1, y2] (-1 if out of memory) */
+long grid_owned(grid_t *grid, int x1, int y1, int x2, int y2) {
+    long a, b, c, d;
+
+    if (grid->price_sum == NULL && sums_build(grid) == -1) {
+        return -1;
+    }
+
+    prefix_sum(grid, x2 + 1, y2 + 1, &a);
+    prefix_sum(grid, x1, y2 + 1, &b);
+    prefix_sum(grid, x2 + 1, y1, &c);
+    prefix_sum(grid, x1, y1, &d);
+
+    return a - b - c + d;
+}
+
+/* Get max over the columns [y1, y2] of one max tree row */
+static long long row_max(grid_t *grid, int i, int y1, int y2) {
+    long long *row = grid->max + (size_t)i * 2 * grid->n, best = -1;
+    int l = y1 + grid->n, r = y2 + grid->n + 1;
+
+    for (; l < r; l >>= 1, r >>= 1) {
+        if (l & 1) { if (row[l] > best) best = row[l]; l++; }
+        if (r & 1) { r--; if (row[r] > best) best = row[r]; }
+    }
+
+    return best;
+}
+
+/* Get highest price in [x1, x2] x [y1, y2] and its cell (smallest x, then y on ties)
+ * -1 if out of memory */
+int grid_max(grid_t *grid, int x1, int y1, int x2, int y2, int *x, int *y) {
+    long long best = -1, m;
+    int l = x1 + grid->n, r = x2 + grid->n + 1, cell;
+
+    if (grid->max == NULL && max_build(grid) == -1) {
+        return -1;
+    }
+
+    for (; l < r; l >>= 1, r >>= 1) {
+        if (l & 1) { if ((m = row_max(grid, l++, y1, y2)) > best) best = m; }
+        if (r & 1) { if ((m = row_max(grid, --r, y1, y2)) > best) best = m; }
+    }
+
+    cell = (int)(CELL_MASK - (best & CELL_MASK));
+    *x = cell / grid->n;
+    *y = cell % grid->n;
+
+    return (int)(best >> CELL_BITS);
+}
@@ -0,0 +1,28 @@
+#ifndef __GRID_H__
+#define __GRID_H__
+
+// Aggregates over an n x n grid of area cells (prices and owned flags)
+// Fenwick trees for sums, a 2D segment tree for the maximum
+// each is built from the cells on the first query that needs it, then kept current
+struct grid_s {
+    int         n;
+    const int  *price;      // cells, row-major (NULL is all 0)
+    const int  *owner;      // cells, row-major, -1 if not owned (NULL is none)
+
+    long long  *price_sum;  // Fenwick, (n + 1) x (n + 1), 1-based, NULL until queried
+    int        *owned;      // Fenwick, (n + 1) x (n + 1), 1-based, NULL until queried
+    long long  *max;        // segment tree, 2n x 2n, (price << 20) | (cell complement), NULL until queried
+};
+
+typedef struct grid_s grid_t;
+
+
+// Grid implementation
+grid_t     *grid_create(int n);
+void        grid_build(grid_t *grid, const int *price, const int *owner);
+void        grid_update(grid_t *grid, int x, int y, int old_price, int price, int old_owned, int owned);
+long long   grid_sum(grid_t *grid, int x1, int y1, int x2, int y2);
+long        grid_owned(grid_t *grid, int x1, int y1, int x2, int y2);
+int         grid_max(grid_t *grid, int x1, int y1, int x2, int y2, int *x, int *y);
+
+#endif
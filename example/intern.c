@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+#define INTERN_TABLE    1024        // initial hash slots
+#define INTERN_CHARS    (16 << 10)  // initial bytes of strings
+
+/* Hash of the string (FNV-1a) */
+static unsigned int hash(const char *str, int len) {
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/* Create empty pool */
+intern_t *intern_create() {
+    intern_t *pool;
+
+    if ((pool = malloc(sizeof(intern_t))) == NULL) {
+        return NULL;
+    }
+
+    pool->chars   = malloc(INTERN_CHARS);
+    pool->offsets = malloc(INTERN_TABLE / 2 * sizeof(unsigned int));
+    pool->table   = calloc(INTERN_TABLE, sizeof(unsigned int));
+
+    if (pool->chars == NULL || pool->offsets == NULL || pool->table == NULL) {
+        free(pool->chars);
+        free(pool->offsets);
+        free(pool->table);
+        free(pool);
+        return NULL;
+    }
+
+    pool->len     = 0;
+    pool->cap     = INTERN_CHARS;
+    pool->count   = 0;
+    pool->ids_cap = INTERN_TABLE / 2;
+    pool->mask    = INTERN_TABLE - 1;
+
+    return pool;
+}
+
+/* Double the hash table, placing every id again */
+static int grow_table(intern_t *pool) {
+    unsigned int *table, mask = 2 * pool->mask + 1, id, i;
+    const char *str;
+
+    if ((table = calloc(mask + 1, sizeof(unsigned int))) == NULL) {
+        return -1;
+    }
+
+    for (id = 0; id < pool->count; id++) {
+        str = pool->chars + pool->offsets[id];
+        for (i = hash(str, strlen(str)) & mask; table[i] != 0; i = (i + 1) & mask);
+        table[i] = id + 1;
+    }
+
+    free(pool->table);
+    pool->table = table;
+    pool->mask  = mask;
+
+    return 0;
+}
+
+/* Get id of the string, adding it if it is new (INTERN_NONE if out of memory)
+ * the table stays at most half full */
+unsigned int intern_add(intern_t *pool, const char *str, int len) {
+    unsigned int i, *offsets;
+    const char *s;
+    char *chars;
+
+    for (i = hash(str, len) & pool->mask; pool->table[i] != 0; i = (i + 1) & pool->mask) {
+        s = pool->chars + pool->offsets[pool->table[i] - 1];
+        if (strncmp(s, str, len) == 0 && s[len] == '\0') {
+            return pool->table[i] - 1;
+        }
+    }
+
+    // New string
+    while (pool->len + len + 1 > pool->cap) {
+        if ((chars = realloc(pool->chars, 2 * pool->cap)) == NULL) {
+            return INTERN_NONE;
+        }
+        pool->chars = chars;
+        pool->cap  *= 2;
+    }
+
+    if (pool->count == pool->ids_cap) {
+        if ((offsets = realloc(pool->offsets, 2 * pool->ids_cap * sizeof(unsigned int))) == NULL) {
+            return INTERN_NONE;
+        }
+        pool->offsets  = offsets;
+        pool->ids_cap *= 2;
+    }
+
+    memcpy(pool->chars + pool->len, str, len);
+    pool->chars[pool->len + len] = '\0';
+
+    pool->offsets[pool->count] = pool->len;
+    pool->table[i] = pool->count + 1;
+    pool->len += len + 1;
+
+    if (2 * ++pool->count > pool->mask && grow_table(pool) == -1) {
+        return INTERN_NONE;
+    }
+
+    return pool->count - 1;
+}
+
+/* Get the string of the id (valid until the next string is added) */
+const char *intern_get(intern_t *pool, unsigned int id) {
+    return pool->chars + pool->offsets[id];
+}
@@ -0,0 +1,26 @@
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#define INTERN_NONE     0xffffffffu     // no id (out of memory)
+
+// Pool of distinct strings, each referenced by a 32-bit id
+struct intern_s {
+    char         *chars;    // strings, NUL terminated, back to back
+    size_t        len, cap;
+
+    unsigned int *offsets;  // start of each string in chars, by id
+    unsigned int  count, ids_cap;
+
+    unsigned int *table;    // open addressing, id + 1 (0 is empty)
+    unsigned int  mask;     // table size - 1
+};
+
+typedef struct intern_s intern_t;
+
+
+// String pool implementation
+intern_t       *intern_create();
+unsigned int    intern_add(intern_t *pool, const char *str, int len);
+const char     *intern_get(intern_t *pool, unsigned int id);
+
+#endif
@@ -0,0 +1,80 @@
+/* includes */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../rbt.h"
+
+
+/* Defines */
+#define POOL_NODES      16
+#define EXPECT(cond)    do { if (!(cond)) { \
+                            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+                            return 1; } } while (0)
+
+
+/* Declare function prototype */
+int             check(rb_tree_t *tree, rb_node_t *pool, const char *title);
+
+
+/* Global variables */
+static rb_node_t    tier_nodes[POOL_NODES];
+static rb_tree_t    tiers = RB_FIXED_INIT(tier_nodes);
+
+
+/* Main function */
+int main() {
+    rb_node_t pool[POOL_NODES];
+    rb_tree_t tree;
+    int failed = 0;
+
+    // Static tree, ready without any call
+    failed |= check(&tiers, tier_nodes, "static");
+
+    // Tree over a pool on the stack
+    rb_init_fixed(&tree, pool, POOL_NODES);
+    failed |= check(&tree, pool, "stack ");
+
+    return failed;
+}
+
+/* Fill the pool, hit the limit, then erase and reuse the freed node */
+int check(rb_tree_t *tree, rb_node_t *pool, const char *title) {
+    rb_node_t *node;
+    rb_key_t key;
+
+    // Fill every node of the pool
+    for (key = 1; key <= POOL_NODES; key++) {
+        EXPECT(rb_insert(tree, key * 10, NULL) == 0);
+    }
+    EXPECT(tree->size == POOL_NODES);
+
+    // Duplicate and exhaustion are told apart
+    EXPECT(rb_insert(tree, 50, NULL) == RB_EXISTS);
+    EXPECT(rb_insert(tree, 55, NULL) == RB_FULL);
+    EXPECT(rb_find(tree, 55, NULL) == -1);
+    EXPECT(tree->size == POOL_NODES);
+
+    // Erased node is given back, and taken by the next insert
+    EXPECT(rb_erase_range(tree, 50, 50, NULL) == 1);
+    EXPECT(rb_find(tree, 50, NULL) == -1);
+
+    EXPECT(rb_insert(tree, 55, NULL) == 0);
+    EXPECT(rb_find(tree, 55, &node) >= 0);
+    EXPECT(node >= pool && node < pool + POOL_NODES);
+    EXPECT(rb_insert(tree, 56, NULL) == RB_FULL);
+
+    // Still a search tree over the same keys
+    for (key = 1, node = rb_first(tree); node != NULL; node = rb_next(tree, node)) {
+        if (key == 5) {
+            EXPECT(node->key == 55);
+        } else {
+            EXPECT(node->key == key * 10);
+        }
+        key++;
+    }
+    EXPECT(key == POOL_NODES + 1);
+
+    printf("%s pool of %d nodes  ok\n", title, POOL_NODES);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/* includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "../rbt.h"
+
+
+/* Defines */
+#define NUM_KEYS        200000
+#define ROUNDS          20          // traversals per thread count, on the same crew
+
+
+/* Declare function prototype */
+unsigned int    next_random();
+void            visit(rb_node_t *node, void *acc);
+void            reduce(void *acc, void *part);
+int             check(rb_tree_t *tree, const char *title, int nthreads);
+
+int             __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                    void *(*start)(void *), void *arg);
+
+
+/* Global variables */
+unsigned int    random_state = 2463534242u;
+int             create_budget = -1;    // threads pthread_create may still start (-1 no limit)
+
+// Accumulator of a traversal (sums of keys and squares catch misses and repeats)
+struct sum_s {
+    unsigned long count;
+    unsigned long long keys;
+    unsigned long long squares;
+};
+
+
+/* Main function */
+int main() {
+    rb_tree_t *tree = rb_create();
+    int nthreads[] = { 1, 2, 3, 4, 8, 16 };
+    int i, failed = 0;
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        rb_insert(tree, next_random() % (8 * NUM_KEYS), NULL);
+    }
+
+    // Crew started once, then reused
+    for (i = 0; i < (int)(sizeof(nthreads) / sizeof(nthreads[0])); i++) {
+        failed |= check(tree, "reused ", nthreads[i]);
+    }
+
+    // Crew started again after shutdown, but only 2 threads can be created
+    rb_parallel_shutdown();
+    create_budget = 2;
+    failed |= check(tree, "limited", 8);
+
+    rb_parallel_shutdown();
+
+    return failed;
+}
+
+/* Count the node, and sum its key */
+void visit(rb_node_t *node, void *acc) {
+    struct sum_s *sum = (struct sum_s *)acc;
+
+    sum->count++;
+    sum->keys    += node->key;
+    sum->squares += (unsigned long long)node->key * node->key;
+}
+
+/* Merge a per-thread sum */
+void reduce(void *acc, void *part) {
+    struct sum_s *sum = (struct sum_s *)acc;
+    struct sum_s *add = (struct sum_s *)part;
+
+    sum->count   += add->count;
+    sum->keys    += add->keys;
+    sum->squares += add->squares;
+}
+
+/* Compare parallel traversals against the sequential one */
+int check(rb_tree_t *tree, const char *title, int nthreads) {
+    struct sum_s seq = { 0, 0, 0 }, par;
+    rb_node_t *node;
+    int round;
+
+    for (node = rb_first(tree); node != NULL; node = rb_next(tree, node)) {
+        visit(node, &seq);
+    }
+
+    for (round = 0; round < ROUNDS; round++) {
+        par.count = par.keys = par.squares = 0;
+
+        if (rb_foreach_parallel(tree, visit, reduce, &par, sizeof(par), nthreads) != 0
+                || par.count != seq.count || par.keys != seq.keys
+                || par.squares != seq.squares) {
+            printf("%s threads %2d  FAIL (round %d, %lu of %lu nodes)\n",
+                title, nthreads, round, par.count, seq.count);
+            return 1;
+        }
+    }
+
+    printf("%s threads %2d  ok (%lu nodes, %d rounds)\n",
+        title, nthreads, seq.count, ROUNDS);
+
+    return 0;
+}
+
+/* pthread_create, failing once the budget is spent (linked with --wrap) */
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+        void *(*start)(void *), void *arg) {
+    if (create_budget == 0) {
+        return EAGAIN;
+    }
+    if (create_budget > 0) {
+        create_budget--;
+    }
+
+    return __real_pthread_create(thread, attr, start, arg);
+}
+
+/* Get next random number (xorshift32) */
+unsigned int next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return random_state;
+}
@@ -1,12 +1,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "rbt.h"
+#include "rbt_trace.h"
 
 #define RED     0
 #define BLACK   1
 
+#define FILTER_BLOCK_WORDS  8    // 8 * 64 bits = one cache line
+#define FILTER_MAX_HASHES   16
+
+#define DENSE_PAGE_BITS     10   // 1024 slots per page
+#define DENSE_PAGE_SIZE     (1 << DENSE_PAGE_BITS)
+#define DENSE_MIN_KEYS      1024 // never switch in for tiny trees
+
+#define BATCH_INFLIGHT      16   // interleaved lookups of rb_find_batch
+
+static int  insert(rb_tree_t *tree, rb_key_t ikey, void *value, int *depth);
+static int  find(rb_tree_t *tree, rb_key_t skey, rb_node_t **found);
+static int  small_find(rb_small_t *small, rb_key_t skey, rb_node_t **found);
+static void filter_add(rb_filter_t *filter, rb_key_t key);
+static void dense_add(rb_tree_t *tree, rb_node_t *node);
+static void cache_forget(rb_tree_t *tree, rb_node_t *node);
+static unsigned long drop_subtree(rb_tree_t *tree, rb_node_t *node,
+        int erased, rb_free_t free_cb);
+
+#if RB_POLICY == RB_POLICY_RB
+static void remedy_double_red(rb_tree_t *tree, rb_node_t *node, int depth);
+#elif RB_POLICY == RB_POLICY_AVL
+static void avl_update(rb_node_t *node);
+static void avl_rebalance(rb_tree_t *tree, rb_node_t *node);
+#elif RB_POLICY == RB_POLICY_TREAP
+static unsigned int treap_priority();
+static void treap_sift_up(rb_tree_t *tree, rb_node_t *node);
+#elif RB_POLICY == RB_POLICY_SPLAY
+static void splay(rb_tree_t *tree, rb_node_t *node);
+#endif
+
 /* Create Red-Black Tree */
 rb_tree_t *rb_create() {
     rb_tree_t *tree = NULL;
@@ -15,7 +47,52 @@ rb_tree_t *rb_create() {
         return NULL;
     }
 
-    tree->root = NULL;
+    tree->root   = NULL;
+    tree->size   = 0;
+    tree->cache  = NULL;
+    tree->filter = NULL;
+    tree->dense  = NULL;
+    tree->small  = NULL;
+    tree->pool   = NULL;
+    tree->used   = 0;
+    tree->hook   = NULL;
+
+    tree->free_nodes = NULL;
+
+    return tree;
+}
+
+/* Initiate fixed-capacity tree over caller's nodes (no heap is used)
+ * insert returns RB_FULL once all nodes of the pool are taken */
+void rb_init_fixed(rb_tree_t *tree, rb_node_t *pool, unsigned long capacity) {
+    memset(tree, 0, sizeof(rb_tree_t));
+
+    tree->pool     = pool;
+    tree->capacity = capacity;
+}
+
+/* Create Red-Black Tree starting as a small sorted array
+ * node pointers of a tree in array mode are valid only until next insert */
+rb_tree_t *rb_create_small(int threshold) {
+    rb_tree_t *tree = NULL;
+
+    if (threshold < 1 || threshold > RB_SMALL_MAX) {
+        return NULL;
+    }
+
+    // Tree, array header, keys and depths in one allocation, so lookups never leave it
+    if ((tree = malloc(sizeof(rb_tree_t) + sizeof(rb_small_t)
+            + threshold * (sizeof(rb_key_t) + 1))) == NULL) {
+        return NULL;
+    }
+
+    memset(tree, 0, sizeof(rb_tree_t) + sizeof(rb_small_t));
+
+    tree->small = (rb_small_t *)(tree + 1);
+    tree->small->active    = 1;
+    tree->small->threshold = threshold;
+    tree->small->keys      = (rb_key_t *)(tree->small + 1);
+    tree->small->depths    = (unsigned char *)(tree->small->keys + threshold);
 
     return tree;
 }
@@ -41,30 +118,247 @@ rb_node_t *rb_create_node() {
     return node;
 }
 
-/* Insert {key, value} pair to tree */
+/* Get a node for the tree (from its pool if it has fixed capacity) */
+static rb_node_t *node_alloc(rb_tree_t *tree) {
+    rb_node_t *node;
+
+    if (tree->pool == NULL) {
+        return rb_create_node();
+    }
+
+    // Nodes given back by erase first, then the pool fills up in order
+    if (tree->free_nodes != NULL) {
+        node = tree->free_nodes;
+        tree->free_nodes = node->right;
+    } else if (tree->used == tree->capacity) {
+        return NULL;
+    } else {
+        node = &tree->pool[tree->used++];
+    }
+
+    memset(node, 0, sizeof(rb_node_t));
+
+    return node;
+}
+
+/* Give the node back (to the pool if the tree has fixed capacity) */
+static void node_free(rb_tree_t *tree, rb_node_t *node) {
+    cache_forget(tree, node);
+
+    if (tree->pool == NULL) {
+        free(node);
+        return;
+    }
+
+    node->right = tree->free_nodes;
+    tree->free_nodes = node;
+}
+
+/* Get position of the key in the small array (count if larger than all) */
+static int small_lower_bound(rb_small_t *small, rb_key_t key) {
+    int i, pos = 0;
+
+    // Count the smaller keys over at most two cache lines, without branches
+    // (vectorized by the compiler, keys are sorted so the count is the position)
+    for (i = 0; i < small->count; i++) {
+        pos += small->keys[i] < key;
+    }
+
+    return pos;
+}
+
+/* Set depths of the positions [lo, hi] in the balanced tree implied by the sorted array */
+static void small_depths(unsigned char *depths, int lo, int hi, int depth) {
+    int mid;
+
+    // Left halves recursively, right halves in the loop
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        depths[mid] = depth++;
+
+        small_depths(depths, lo, mid - 1, depth);
+        lo = mid + 1;
+    }
+}
+
+/* Move keys of the small array into nodes, then insert the new key
+ * if a node can't be had, the nodes are dropped and the array is kept as it was */
+static int small_spill(rb_tree_t *tree, rb_key_t ikey, void *value, int *depth) {
+    rb_small_t *small = tree->small;
+    int i, ret = 0, key_depth;
+
+    small->active = 0;
+    tree->size    = 0;
+
+    for (i = 0; i < small->count && ret == 0; i++) {
+        ret = insert(tree, small->keys[i], small->nodes[i].value, &key_depth);
+    }
+    if (ret == 0) {
+        ret = insert(tree, ikey, value, depth);
+    }
+
+    if (ret != 0) {
+        // Keys are still in the array, so nodes go back without reporting
+        drop_subtree(tree, tree->root, 0, NULL);
+
+        tree->root    = NULL;
+        tree->size    = small->count;
+        small->active = 1;
+
+        return RB_FULL;
+    }
+
+    small->count = 0;
+
+    return 0;
+}
+
+/* Double the node slots of the small array (up to its threshold)
+ * keys are inline in the tree, only the nodes holding values grow */
+static int small_grow(rb_small_t *small) {
+    int capacity = (small->capacity == 0) ? RB_SMALL_MIN : small->capacity * 2;
+    rb_node_t *nodes;
+
+    if (capacity > small->threshold) {
+        capacity = small->threshold;
+    }
+
+    if ((nodes = realloc(small->nodes, capacity * sizeof(rb_node_t))) == NULL) {
+        return -1;
+    }
+
+    small->nodes    = nodes;
+    small->capacity = capacity;
+
+    return 0;
+}
+
+/* Insert {key, value} pair to the small array */
+static int small_insert(rb_tree_t *tree, rb_key_t ikey, void *value, int *depth) {
+    rb_small_t *small = tree->small;
+    int pos = small_lower_bound(small, ikey);
+
+    if (pos < small->count && small->keys[pos] == ikey) {
+        // Already exists
+        return RB_EXISTS;
+    }
+
+    if (small->count == small->threshold) {
+        // Grown past the threshold, continue in node form
+        return small_spill(tree, ikey, value, depth);
+    }
+
+    if (small->count == small->capacity && small_grow(small) != 0) {
+        return RB_FULL;
+    }
+
+    // Shift larger keys to make room
+    memmove(&small->keys[pos + 1], &small->keys[pos],
+        (small->count - pos) * sizeof(rb_key_t));
+    memmove(&small->nodes[pos + 1], &small->nodes[pos],
+        (small->count - pos) * sizeof(rb_node_t));
+
+    small->keys[pos] = ikey;
+    memset(&small->nodes[pos], 0, sizeof(rb_node_t));
+    small->nodes[pos].key   = ikey;
+    small->nodes[pos].value = value;
+
+    small->count++;
+    tree->size++;
+    small_depths(small->depths, 0, small->count - 1, 0);
+
+    if (tree->filter != NULL) {
+        filter_add(tree->filter, ikey);
+    }
+
+    *depth = small->depths[pos];
+
+    return 0;
+}
+
+/* Find the key in the small array by a linear scan
+ * depth is the one in the balanced tree implied by the sorted array */
+static int small_find(rb_small_t *small, rb_key_t skey, rb_node_t **found) {
+    int pos = small_lower_bound(small, skey);
+
+    if (pos == small->count || small->keys[pos] != skey) {
+        if (found != NULL) {
+            *found = NULL;
+        }
+        return -1;
+    }
+
+    if (found != NULL) {
+        *found = &small->nodes[pos];
+    }
+
+    return small->depths[pos];
+}
+
+/* Insert {key, value} pair to tree
+ * returns 0, RB_EXISTS if the key is already there, or RB_FULL */
 int rb_insert(rb_tree_t *tree, rb_key_t ikey, void *value) {
+    int ret, depth;
+
+    RB_PROBE1(insert_entry, ikey);
+    ret = insert(tree, ikey, value, &depth);
+    RB_PROBE3(insert_return, ikey, ret, (ret == 0) ? depth : -1);
+
+    if (ret == 0 && tree->hook != NULL) {
+        tree->hook(tree->hook_ctx, RB_OP_INSERT, ikey, value);
+    }
+
+    return ret;
+}
+
+/* Insert {key, value} pair to tree (without tracepoints)
+ * depth is where the key landed, before any rebalancing */
+static int insert(rb_tree_t *tree, rb_key_t ikey, void *value, int *depth) {
     rb_node_t *root;
     rb_node_t *vacant;
     rb_node_t *parent;
-    rb_node_t *uncle;
+
+    if (tree->small != NULL && tree->small->active) {
+        // Case of small array
+        return small_insert(tree, ikey, value, depth);
+    }
 
     if (tree->root == NULL) {
         // Case of empty
-        root = rb_create_node();
+        if ((root = node_alloc(tree)) == NULL) {
+            return RB_FULL;
+        }
 
         root->key   = ikey;
         root->value = value;
+
+#if RB_POLICY == RB_POLICY_RB
         root->color = BLACK;
+#elif RB_POLICY == RB_POLICY_AVL
+        root->height = 1;
+#elif RB_POLICY == RB_POLICY_TREAP
+        root->priority = treap_priority();
+#endif
 
         tree->root = root;
+        *depth     = 0;
+
+        if (tree->filter != NULL) {
+            filter_add(tree->filter, ikey);
+        }
+        if (tree->dense != NULL) {
+            dense_add(tree, root);
+        }
         
     } else {
         // Common case
         vacant = tree->root;
         parent = NULL;
+        *depth = 0;
         
         while (vacant != NULL) {
             parent = vacant;
+            ++*depth;
             
             if (ikey < vacant->key) {
                 // Go left
@@ -76,12 +370,14 @@ int rb_insert(rb_tree_t *tree, rb_key_t ikey, void *value) {
 
             } else {
                 // Already exists
-                return -1;
+                return RB_EXISTS;
             }
         }
 
         // Create node on the vacant
-        vacant = rb_create_node();
+        if ((vacant = node_alloc(tree)) == NULL) {
+            return RB_FULL;
+        }
 
         vacant->parent = parent;
         vacant->key    = ikey;
@@ -97,15 +393,182 @@ int rb_insert(rb_tree_t *tree, rb_key_t ikey, void *value) {
             parent->right = vacant;
         }
 
+        if (tree->filter != NULL) {
+            filter_add(tree->filter, ikey);
+        }
+        if (tree->dense != NULL) {
+            dense_add(tree, vacant);
+        }
+
         // Load balancing
+#if RB_POLICY == RB_POLICY_RB
         if (parent->color == RED) {
             // Double red occur
-            rb_remedy_double_red(tree, vacant);
+            remedy_double_red(tree, vacant, *depth);
         }
+#elif RB_POLICY == RB_POLICY_AVL
+        vacant->height = 1;
+        avl_rebalance(tree, parent);
+#elif RB_POLICY == RB_POLICY_TREAP
+        vacant->priority = treap_priority();
+        treap_sift_up(tree, vacant);
+#elif RB_POLICY == RB_POLICY_SPLAY
+        splay(tree, vacant);
+#endif
     }
+
+    tree->size++;
+
     return 0;
 }
 
+#if RB_POLICY != RB_POLICY_RB
+/* Rotate the node above its parent (generic single rotation) */
+static void rotate_up(rb_tree_t *tree, rb_node_t *node) {
+    rb_node_t *parent = node->parent;
+    rb_node_t *grand  = parent->parent;
+    rb_node_t *child;
+
+    RB_PROBE2(rotate, node->key, parent->right == node);
+
+    if (parent->left == node) {
+        // Right rotation
+        child = node->right;
+        parent->left = child;
+        node->right  = parent;
+    } else {
+        // Left rotation
+        child = node->left;
+        parent->right = child;
+        node->left    = parent;
+    }
+
+    if (child != NULL) child->parent = parent;
+    parent->parent = node;
+    node->parent   = grand;
+
+    // Connect with ancestor
+    if (grand == NULL) {
+        tree->root = node;
+    } else if (grand->left == parent) {
+        grand->left  = node;
+    } else {
+        grand->right = node;
+    }
+
+#if RB_POLICY == RB_POLICY_AVL
+    // Parent is now below the node, so renew it first
+    avl_update(parent);
+    avl_update(node);
+#endif
+}
+#endif /* RB_POLICY != RB_POLICY_RB */
+
+#if RB_POLICY == RB_POLICY_AVL
+/* Get height of the sub-tree */
+static int avl_height(rb_node_t *node) {
+    return (node == NULL) ? 0 : node->height;
+}
+
+/* Renew height of the node from its children */
+static void avl_update(rb_node_t *node) {
+    int hl = avl_height(node->left);
+    int hr = avl_height(node->right);
+
+    node->height = ((hl > hr) ? hl : hr) + 1;
+}
+
+/* Walk up from the parent of a new leaf, rotating where unbalanced */
+static void avl_rebalance(rb_tree_t *tree, rb_node_t *node) {
+    rb_node_t *child;
+    int old, balance;
+
+    while (node != NULL) {
+        old = node->height;
+        avl_update(node);
+
+        balance = avl_height(node->left) - avl_height(node->right);
+
+        if (balance > 1) {
+            // Left heavy
+            child = node->left;
+            if (avl_height(child->left) < avl_height(child->right)) {
+                // left-right
+                child = child->right;
+                rotate_up(tree, child);
+            }
+            rotate_up(tree, child);
+            node = child;
+
+        } else if (balance < -1) {
+            // Right heavy
+            child = node->right;
+            if (avl_height(child->right) < avl_height(child->left)) {
+                // right-left
+                child = child->left;
+                rotate_up(tree, child);
+            }
+            rotate_up(tree, child);
+            node = child;
+        }
+
+        // Once the sub-tree keeps its height, ancestors are unaffected
+        if (node->height == old) {
+            break;
+        }
+
+        node = node->parent;
+    }
+}
+
+#elif RB_POLICY == RB_POLICY_TREAP
+/* Draw a priority (xorshift32, fixed seed for reproducible shapes) */
+static unsigned int treap_priority() {
+    static unsigned int state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+/* Rotate a new leaf up until heap order of priorities holds */
+static void treap_sift_up(rb_tree_t *tree, rb_node_t *node) {
+    while (node->parent != NULL && node->parent->priority < node->priority) {
+        rotate_up(tree, node);
+    }
+}
+
+#elif RB_POLICY == RB_POLICY_SPLAY
+/* Move the node to the root by zig, zig-zig and zig-zag steps */
+static void splay(rb_tree_t *tree, rb_node_t *node) {
+    rb_node_t *parent;
+    rb_node_t *grand;
+
+    while ((parent = node->parent) != NULL) {
+        grand = parent->parent;
+
+        if (grand == NULL) {
+            // zig
+            rotate_up(tree, node);
+
+        } else if ((grand->left == parent) == (parent->left == node)) {
+            // zig-zig
+            rotate_up(tree, parent);
+            rotate_up(tree, node);
+
+        } else {
+            // zig-zag
+            rotate_up(tree, node);
+            rotate_up(tree, node);
+        }
+    }
+}
+#endif
+
+#if RB_POLICY == RB_POLICY_RB
+
 /* Get sibling of the node */
 static rb_node_t *get_sibling(rb_node_t *node) {
     rb_node_t *sibling;
@@ -123,8 +586,9 @@ static rb_node_t *get_sibling(rb_node_t *node) {
     return sibling;
 }
 
-/* Recolor two RED nodes to BLACK, and a parent of them to RED */
-static void recoloring(rb_tree_t *tree, rb_node_t *node) {
+/* Recolor two RED nodes to BLACK, and a parent of them to RED
+ * depth is that of the node */
+static void recoloring(rb_tree_t *tree, rb_node_t *node, int depth) {
     rb_node_t *parent;
     rb_node_t *sibling;
 
@@ -134,13 +598,16 @@ static void recoloring(rb_tree_t *tree, rb_node_t *node) {
     node->color    = BLACK;
     sibling->color = BLACK;
     
+    RB_PROBE2(recoloring, parent->key, depth - 1);
+
     if (parent != tree->root) {
         parent->color = RED;
         
         // Treat propagation
         if (parent->parent->color == RED) {
             // Double red propagates
-            rb_remedy_double_red(tree, parent); 
+            RB_PROBE2(double_red, parent->key, depth - 1);
+            remedy_double_red(tree, parent, depth - 1);
         }
     }
 
@@ -205,6 +672,10 @@ static void restructuring(rb_tree_t *tree, rb_node_t *node) {
 
     rb_node_t *grand = node->parent->parent;
 
+    RB_PROBE2(restructuring, node->key,
+        ((grand->left == node->parent) ? RB_ROTATION_LL : RB_ROTATION_RL)
+        + (node->parent->left != node));
+
     // Setup pointers (get each position to be restructured)
     restructuring_setup(
         node, &parent, &left, &right, &left_right_child, &right_left_child);
@@ -246,8 +717,9 @@ static void restructuring(rb_tree_t *tree, rb_node_t *node) {
     // On restructuring, it doesn't propagate to upper layer
 }
 
-/* Remedy the double red situation by appropriate solution */
-void rb_remedy_double_red(rb_tree_t *tree, rb_node_t *node) {
+/* Remedy the double red situation by appropriate solution
+ * depth is that of the node, reported by the tracepoints */
+static void remedy_double_red(rb_tree_t *tree, rb_node_t *node, int depth) {
     rb_node_t *parent = node->parent;
     rb_node_t *uncle  = get_sibling(parent);
 
@@ -255,38 +727,1186 @@ void rb_remedy_double_red(rb_tree_t *tree, rb_node_t *node) {
     // So there is no need to doubt that the grand parent is NULL
 
     if (uncle != NULL && uncle->color == RED) { // recoloring
-        recoloring(tree, parent);
+        recoloring(tree, parent, depth - 1);
     } else { // restructuring
         restructuring(tree, node);
     }
 }
 
-/* Find the node */
-int rb_find(rb_tree_t *tree, rb_key_t skey, rb_node_t **found) {
+/* Remedy the double red situation by appropriate solution */
+void rb_remedy_double_red(rb_tree_t *tree, rb_node_t *node) {
+    rb_node_t *cur;
     int depth = 0;
-    rb_node_t *node = tree->root;
 
-    // Search
-    while (node != NULL) {
-        if (skey== node->key) { // find!
-            break;
-        } else if (skey < node->key) { // go left
-            node = node->left;
-        } else { // go right
-            node = node->right;
-        }
+    for (cur = node; cur->parent != NULL; cur = cur->parent) {
         ++depth;
     }
 
-    // Fail to find
+    remedy_double_red(tree, node, depth);
+}
+#endif /* RB_POLICY == RB_POLICY_RB */
+
+#if RB_POLICY != RB_POLICY_SPLAY
+/* Rank of a sub-tree for join: black height (RB), height (AVL), unused (Treap)
+ * heights are kept in nodes, black heights are carried along by split */
+
+/* Get rank of the whole tree */
+static int tree_rank(rb_node_t *root) {
+#if RB_POLICY == RB_POLICY_RB
+    int rank = 0;
+
+    for (; root != NULL; root = root->left) {
+        rank += (root->color == BLACK);
+    }
+
+    return rank;
+#else
+    (void)root;
+    return 0;
+#endif
+}
+
+/* Cut the child off its parent as a tree of its own (rank is updated) */
+static rb_node_t *detach(rb_node_t *node, int *rank) {
     if (node == NULL) {
-        depth = -1;
+        return NULL;
     }
 
-    // Save the node pointer
-    if (found != NULL) {
-        *found = node;
+    node->parent = NULL;
+
+#if RB_POLICY == RB_POLICY_RB
+    // Root must be BLACK, which adds one to the black height
+    if (node->color == RED) {
+        node->color = BLACK;
+        ++*rank;
     }
+#else
+    (void)rank;
+#endif
 
-    return depth;
+    return node;
+}
+
+#if RB_POLICY == RB_POLICY_TREAP
+/* Merge two treaps, all keys of left below all keys of right */
+static rb_node_t *treap_merge(rb_node_t *left, rb_node_t *right) {
+    if (left == NULL) {
+        return right;
+    }
+    if (right == NULL) {
+        return left;
+    }
+
+    if (left->priority > right->priority) {
+        left->right = treap_merge(left->right, right);
+        left->right->parent = left;
+        return left;
+    }
+
+    right->left = treap_merge(left, right->left);
+    right->left->parent = right;
+    return right;
+}
+#endif
+
+/* Join two trees with the node in between (all of left < node < all of right)
+ * descends the taller tree to the rank of the other, so it costs the rank difference */
+static rb_node_t *join(rb_node_t *left, int lrank, rb_node_t *node,
+        rb_node_t *right, int rrank, int *rank) {
+#if RB_POLICY == RB_POLICY_TREAP
+    (void)lrank;
+    (void)rrank;
+
+    node->parent = node->left = node->right = NULL;
+    node = treap_merge(treap_merge(left, node), right);
+    node->parent = NULL;
+
+    *rank = 0;
+
+    return node;
+#else
+    rb_tree_t  sub;
+    rb_node_t *cur = NULL, *parent = NULL;
+    int side = 0;   // -1 node goes into left, 1 into right, 0 on top of both
+#if RB_POLICY == RB_POLICY_RB
+    int h;
+#endif
+
+    memset(&sub, 0, sizeof(rb_tree_t));
+
+#if RB_POLICY == RB_POLICY_AVL
+    lrank = avl_height(left);
+    rrank = avl_height(right);
+
+    if (lrank > rrank + 1) {
+        // Right spine of left, down to the height of right
+        for (cur = left; avl_height(cur) > rrank + 1; cur = cur->right) {
+            parent = cur;
+        }
+        side = -1;
+    } else if (rrank > lrank + 1) {
+        // Left spine of right, down to the height of left
+        for (cur = right; avl_height(cur) > lrank + 1; cur = cur->left) {
+            parent = cur;
+        }
+        side = 1;
+    }
+#else
+    if (lrank > rrank) {
+        // Right spine of left, down to a BLACK node of the black height of right
+        for (cur = left, h = lrank;
+                h != rrank || (cur != NULL && cur->color == RED); cur = cur->right) {
+            h -= (cur->color == BLACK);
+            parent = cur;
+        }
+        side = -1;
+    } else if (rrank > lrank) {
+        // Left spine of right, likewise
+        for (cur = right, h = rrank;
+                h != lrank || (cur != NULL && cur->color == RED); cur = cur->left) {
+            h -= (cur->color == BLACK);
+            parent = cur;
+        }
+        side = 1;
+    }
+#endif
+
+    if (side < 0) {
+        // Node takes the place of cur, right of right spine's parent
+        node->left    = cur;
+        node->right   = right;
+        parent->right = node;
+        sub.root      = left;
+    } else if (side > 0) {
+        node->left    = left;
+        node->right   = cur;
+        parent->left  = node;
+        sub.root      = right;
+    } else {
+        // Close enough in rank, node becomes the root
+        node->left    = left;
+        node->right   = right;
+        sub.root      = node;
+    }
+
+    node->parent = parent;
+    if (node->left  != NULL) node->left->parent  = node;
+    if (node->right != NULL) node->right->parent = node;
+
+#if RB_POLICY == RB_POLICY_AVL
+    avl_update(node);
+    if (parent != NULL) {
+        avl_rebalance(&sub, parent);
+    }
+
+    *rank = sub.root->height;
+#else
+    if (side == 0) {
+        node->color = BLACK;
+        *rank = lrank + 1;
+        return node;
+    }
+
+    // Same as a new RED leaf there, though the node has sub-trees
+    node->color = RED;
+    *rank = (lrank > rrank) ? lrank : rrank;
+
+    for (cur = node; (parent = cur->parent) != NULL && parent->color == RED; ) {
+        // RED parent is not the root, so the grand parent exists
+        if (get_sibling(parent) != NULL && get_sibling(parent)->color == RED) {
+            parent->color = BLACK;
+            get_sibling(parent)->color = BLACK;
+            parent->parent->color = RED;
+            cur = parent->parent;
+        } else {
+            restructuring(&sub, cur);
+            break;
+        }
+    }
+
+    if (sub.root->color == RED) {
+        // Recoloring reached the root
+        sub.root->color = BLACK;
+        ++*rank;
+    }
+#endif
+
+    return sub.root;
+#endif
+}
+
+/* Split the tree into keys below the key and keys above it
+ * returns the node of the key itself (NULL if absent) */
+static rb_node_t *split(rb_node_t *root, int rank, rb_key_t key,
+        rb_node_t **left, int *lrank, rb_node_t **right, int *rrank) {
+    rb_node_t *mid, *l, *r, *part;
+    int lr, rr, pr;
+
+    if (root == NULL) {
+        *left  = *right = NULL;
+        *lrank = *rrank = 0;
+        return NULL;
+    }
+
+    // Children stand alone, one rank below the root (same if the root is RED)
+#if RB_POLICY == RB_POLICY_RB
+    lr = rr = rank - (root->color == BLACK);
+#else
+    (void)rank;
+    lr = rr = 0;
+#endif
+    l = detach(root->left, &lr);
+    r = detach(root->right, &rr);
+
+    if (key == root->key) {
+        *left  = l;  *lrank = lr;
+        *right = r;  *rrank = rr;
+        return root;
+    }
+
+    if (key < root->key) {
+        mid    = split(l, lr, key, left, lrank, &part, &pr);
+        *right = join(part, pr, root, r, rr, rrank);
+    } else {
+        mid    = split(r, rr, key, &part, &pr, right, rrank);
+        *left  = join(l, lr, root, part, pr, lrank);
+    }
+
+    return mid;
+}
+#endif /* RB_POLICY != RB_POLICY_SPLAY */
+
+/* Hash the key to 64 bits (splitmix64 finalizer) */
+static unsigned long long filter_hash(rb_key_t key) {
+    unsigned long long h = key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* Get the block of the hashed key */
+static unsigned long long *filter_block(rb_filter_t *filter, unsigned long long h) {
+    // Map upper 32 bits onto [0, nblocks) without division
+    unsigned long long idx = ((h >> 32) * filter->nblocks) >> 32;
+
+    return &filter->blocks[idx * FILTER_BLOCK_WORDS];
+}
+
+/* Set the bits of the key */
+static void filter_add(rb_filter_t *filter, rb_key_t key) {
+    unsigned long long h      = filter_hash(key);
+    unsigned long long *block = filter_block(filter, h);
+    unsigned int h1 = (unsigned int)h;
+    unsigned int h2 = (unsigned int)(h >> 16) | 1;
+    unsigned int bit;
+    int i;
+
+    // Every bit of the key lives in the same block
+    for (i = 0; i < filter->nhashes; i++) {
+        bit = (h1 + i * h2) & (FILTER_BLOCK_WORDS * 64 - 1);
+        block[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+/* Test the bits of the key (0 means surely absent) */
+static int filter_test(rb_filter_t *filter, rb_key_t key) {
+    unsigned long long h      = filter_hash(key);
+    unsigned long long *block = filter_block(filter, h);
+    unsigned int h1 = (unsigned int)h;
+    unsigned int h2 = (unsigned int)(h >> 16) | 1;
+    unsigned int bit;
+    int i;
+
+    for (i = 0; i < filter->nhashes; i++) {
+        bit = (h1 + i * h2) & (FILTER_BLOCK_WORDS * 64 - 1);
+        if ((block[bit >> 6] & (1ULL << (bit & 63))) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Get the dense slot of the key (NULL if out of range or page is empty) */
+static rb_node_t **dense_slot(rb_dense_t *dense, rb_key_t key) {
+    unsigned long off;
+
+    if (key < dense->base) {
+        return NULL;
+    }
+
+    off = (unsigned long)(key - dense->base);
+    if ((off >> DENSE_PAGE_BITS) >= dense->npages
+            || dense->pages[off >> DENSE_PAGE_BITS] == NULL) {
+        return NULL;
+    }
+
+    return &dense->pages[off >> DENSE_PAGE_BITS][off & (DENSE_PAGE_SIZE - 1)];
+}
+
+/* Get the node of the key by direct addressing */
+static rb_node_t *dense_lookup(rb_dense_t *dense, rb_key_t key) {
+    rb_node_t **slot = dense_slot(dense, key);
+
+    return (slot == NULL) ? NULL : *slot;
+}
+
+/* Make the page table cover the key, then store the node */
+static int dense_store(rb_dense_t *dense, rb_node_t *node) {
+    rb_key_t key = node->key;
+    rb_key_t base;
+    rb_node_t ***pages;
+    unsigned long npages, shift, off;
+
+    // Grow downwards: re-base and move existing pages up
+    if (dense->npages == 0 || key < dense->base) {
+        base   = key & ~(rb_key_t)(DENSE_PAGE_SIZE - 1);
+        shift  = (dense->npages == 0) ? 0
+               : (unsigned long)(dense->base - base) >> DENSE_PAGE_BITS;
+        npages = dense->npages + shift;
+        if (npages == 0) {
+            npages = 1;
+        }
+
+        if ((pages = realloc(dense->pages, npages * sizeof(rb_node_t **))) == NULL) {
+            return -1;
+        }
+
+        memmove(pages + shift, pages, dense->npages * sizeof(rb_node_t **));
+        memset(pages, 0, (npages - dense->npages) * sizeof(rb_node_t **));
+
+        dense->pages  = pages;
+        dense->base   = base;
+        dense->npages = npages;
+    }
+
+    off = (unsigned long)(key - dense->base);
+
+    // Grow upwards
+    if ((off >> DENSE_PAGE_BITS) >= dense->npages) {
+        npages = (off >> DENSE_PAGE_BITS) + 1;
+
+        if ((pages = realloc(dense->pages, npages * sizeof(rb_node_t **))) == NULL) {
+            return -1;
+        }
+
+        memset(pages + dense->npages, 0,
+            (npages - dense->npages) * sizeof(rb_node_t **));
+
+        dense->pages  = pages;
+        dense->npages = npages;
+    }
+
+    // Allocate page on its first key
+    if (dense->pages[off >> DENSE_PAGE_BITS] == NULL) {
+        dense->pages[off >> DENSE_PAGE_BITS] =
+            calloc(DENSE_PAGE_SIZE, sizeof(rb_node_t *));
+
+        if (dense->pages[off >> DENSE_PAGE_BITS] == NULL) {
+            return -1;
+        }
+    }
+
+    dense->pages[off >> DENSE_PAGE_BITS][off & (DENSE_PAGE_SIZE - 1)] = node;
+
+    return 0;
+}
+
+/* Store nodes of the sub-tree to the page table */
+static int dense_store_subtree(rb_dense_t *dense, rb_node_t *node) {
+    while (node != NULL) {
+        if (dense_store(dense, node) == -1
+                || dense_store_subtree(dense, node->left) == -1) {
+            return -1;
+        }
+        node = node->right;
+    }
+
+    return 0;
+}
+
+/* Drop all pages of the dense index */
+static void dense_clear(rb_dense_t *dense) {
+    unsigned long i;
+
+    for (i = 0; i < dense->npages; i++) {
+        free(dense->pages[i]);
+    }
+    free(dense->pages);
+
+    dense->pages  = NULL;
+    dense->npages = 0;
+    dense->active = 0;
+}
+
+/* Drop the index after an allocation failure, not trying again
+ * before the tree has doubled (each try stores every key) */
+static void dense_fail(rb_dense_t *dense, unsigned long size) {
+    dense_clear(dense);
+
+    dense->retry_size = 2 * size;
+}
+
+/* Switch the dense index in if the key range is dense enough,
+ * or out once it is less than half that dense */
+static void dense_check(rb_tree_t *tree, unsigned long size) {
+    rb_dense_t *dense = tree->dense;
+    double range = (double)(dense->max_key - dense->min_key) + 1;
+
+    if (dense->active) {
+        // Lower bound to switch out, so a range near the line doesn't flip each time
+        if (size < DENSE_MIN_KEYS / 2 || size < dense->min_density / 2 * range) {
+            dense_clear(dense);
+        }
+        return;
+    }
+
+    if (size >= DENSE_MIN_KEYS && size >= dense->retry_size
+            && size >= dense->min_density * range) {
+        dense->active = 1;
+
+        if (dense_store_subtree(dense, tree->root) == -1) {
+            dense_fail(dense, size);
+        }
+    }
+}
+
+/* Account a new node to the dense index */
+static void dense_add(rb_tree_t *tree, rb_node_t *node) {
+    rb_dense_t *dense = tree->dense;
+    unsigned long size = tree->size + 1; // node is not counted yet
+
+    if (size == 1 || node->key < dense->min_key) dense->min_key = node->key;
+    if (size == 1 || node->key > dense->max_key) dense->max_key = node->key;
+
+    // Widened range may have left it too sparse
+    dense_check(tree, size);
+
+    // On allocation failure fall back to the tree
+    if (dense->active && dense_store(dense, node) == -1) {
+        dense_fail(dense, size);
+    }
+}
+
+/* Get the cache slot of the key */
+static struct rb_cache_slot_s *cache_slot(rb_cache_t *cache, rb_key_t key) {
+    // Fibonacci hashing spreads sequential ids over the slots
+    return &cache->slots[(unsigned int)(key * 2654435769u) >> cache->shift];
+}
+
+/* Drop the node from the cache before it is freed (nodes never move otherwise) */
+static void cache_forget(rb_tree_t *tree, rb_node_t *node) {
+    struct rb_cache_slot_s *slot;
+
+    if (tree->cache != NULL && (slot = cache_slot(tree->cache, node->key))->node == node) {
+        slot->node = NULL;
+    }
+}
+
+/* Get depth of the node by walking up to the root */
+static int node_depth(rb_node_t *node) {
+    int depth = 0;
+
+    while ((node = node->parent) != NULL) {
+        ++depth;
+    }
+
+    return depth;
+}
+
+/* Find the node */
+int rb_find(rb_tree_t *tree, rb_key_t skey, rb_node_t **found) {
+    int depth;
+
+    RB_PROBE1(find_entry, skey);
+    depth = find(tree, skey, found);
+    RB_PROBE2(find_return, skey, depth);
+
+    return depth;
+}
+
+/* Find the node (without tracepoints) */
+static int find(rb_tree_t *tree, rb_key_t skey, rb_node_t **found) {
+    int depth = 0;
+    rb_node_t *node = tree->root;
+    rb_node_t *last = NULL;
+    struct rb_cache_slot_s *slot = NULL;
+
+    // Tiny tree is answered by the sorted array
+    if (tree->small != NULL && tree->small->active) {
+        return small_find(tree->small, skey, found);
+    }
+
+    // Hot key is answered by one probe, its depth by the walk up
+    // (rotations keep the node, so it stays valid until erased)
+    if (tree->cache != NULL) {
+        slot = cache_slot(tree->cache, skey);
+
+        if (slot->node != NULL && slot->key == skey) {
+            tree->cache->hits++;
+            node  = slot->node;
+            depth = node_depth(node);
+            last  = node;
+            goto done;
+        }
+        tree->cache->misses++;
+    }
+
+    // Absent key is (mostly) answered by one cache line
+    if (tree->filter != NULL && !filter_test(tree->filter, skey)) {
+        tree->filter->rejects++;
+
+        if (found != NULL) {
+            *found = NULL;
+        }
+        return -1;
+    }
+
+    // Search
+    while (node != NULL) {
+        last = node;
+
+        if (skey== node->key) { // find!
+            break;
+        } else if (skey < node->key) { // go left
+            node = node->left;
+        } else { // go right
+            node = node->right;
+        }
+        ++depth;
+    }
+
+    // Fail to find
+    if (node == NULL) {
+        depth = -1;
+
+    } else if (slot != NULL) {
+        // Remember the hit for the next lookup
+        slot->key  = skey;
+        slot->node = node;
+    }
+
+done:
+#if RB_POLICY == RB_POLICY_SPLAY
+    // Splay the last visited node; reported depth is the one before splaying
+    if (last != NULL) {
+        splay(tree, last);
+    }
+#else
+    (void)last;
+#endif
+
+    // Save the node pointer
+    if (found != NULL) {
+        *found = node;
+    }
+
+    return depth;
+}
+
+// In-flight lookup of rb_find_batch (suspended between two node visits)
+struct lookup_s {
+    int        idx;     // index into the batch, -1 if idle
+    int        depth;
+    rb_node_t *node;    // next node to visit, already prefetched
+};
+
+/* Start the next lookup of the batch on the slot */
+static void batch_start(rb_tree_t *tree, struct lookup_s *lookup,
+        const rb_key_t *skeys, int *next, int n, int *depths, rb_node_t **found) {
+    // Keys rejected by the filter never occupy a slot
+    while (*next < n && tree->filter != NULL
+            && !filter_test(tree->filter, skeys[*next])) {
+        tree->filter->rejects++;
+
+        depths[*next] = -1;
+        if (found != NULL) {
+            found[*next] = NULL;
+        }
+        ++*next;
+    }
+
+    if (*next == n) {
+        lookup->idx = -1;
+        return;
+    }
+
+    lookup->idx   = (*next)++;
+    lookup->depth = 0;
+    lookup->node  = tree->root;
+
+    __builtin_prefetch(lookup->node);
+}
+
+/* Find many keys at once, interleaving the lookups
+ * each lookup visits one node, prefetches the next and yields to the
+ * others, so cache misses of different lookups overlap.
+ * Results are the same as calling rb_find for each key */
+void rb_find_batch(rb_tree_t *tree, const rb_key_t *skeys, int n,
+        int *depths, rb_node_t **found) {
+    struct lookup_s inflight[BATCH_INFLIGHT];
+    struct lookup_s *lookup;
+    rb_node_t *node;
+    int next = 0, active = 0, i;
+
+    // Array mode is already one probe (and splay must reshape)
+    if (RB_POLICY == RB_POLICY_SPLAY || (tree->small != NULL && tree->small->active)) {
+        for (i = 0; i < n; i++) {
+            depths[i] = rb_find(tree, skeys[i], (found != NULL) ? &found[i] : NULL);
+        }
+        return;
+    }
+
+    for (i = 0; i < BATCH_INFLIGHT; i++) {
+        batch_start(tree, &inflight[i], skeys, &next, n, depths, found);
+        if (inflight[i].idx != -1) {
+            ++active;
+        }
+    }
+
+    // Round robin over the in-flight lookups
+    while (active > 0) {
+        for (i = 0; i < BATCH_INFLIGHT; i++) {
+            lookup = &inflight[i];
+            if (lookup->idx == -1) {
+                continue;
+            }
+
+            node = lookup->node;
+
+            if (node != NULL && skeys[lookup->idx] != node->key) {
+                // Go down, and yield until the child arrives
+                node = (skeys[lookup->idx] < node->key) ? node->left : node->right;
+                lookup->node = node;
+                lookup->depth++;
+
+                __builtin_prefetch(node);
+                continue;
+            }
+
+            // Found, or fail to find
+            depths[lookup->idx] = (node == NULL) ? -1 : lookup->depth;
+            if (found != NULL) {
+                found[lookup->idx] = node;
+            }
+
+            batch_start(tree, lookup, skeys, &next, n, depths, found);
+            if (lookup->idx == -1) {
+                --active;
+            }
+        }
+    }
+}
+
+/* Get the node of the key, without computing its depth */
+rb_node_t *rb_get(rb_tree_t *tree, rb_key_t skey) {
+    rb_node_t *node;
+
+    if (tree->dense != NULL && tree->dense->active) {
+        return dense_lookup(tree->dense, skey);
+    }
+
+    rb_find(tree, skey, &node);
+
+    return node;
+}
+
+/* Drop the node of an erased key (hook, callback, indexes, then the node) */
+static void erase_node(rb_tree_t *tree, rb_node_t *node, rb_free_t free_cb) {
+    rb_node_t **slot;
+
+    if (tree->hook != NULL) {
+        tree->hook(tree->hook_ctx, RB_OP_ERASE, node->key, node->value);
+    }
+    if (free_cb != NULL) {
+        free_cb(node->value);
+    }
+
+    if (tree->dense != NULL && tree->dense->active
+            && (slot = dense_slot(tree->dense, node->key)) != NULL) {
+        *slot = NULL;
+    }
+
+    node_free(tree, node);
+}
+
+/* Drop every node of the detached sub-tree, leaves first (no stack)
+ * erased ones are reported, others only give their nodes back */
+static unsigned long drop_subtree(rb_tree_t *tree, rb_node_t *node,
+        int erased, rb_free_t free_cb) {
+    rb_node_t *parent;
+    unsigned long count = 0;
+
+    while (node != NULL) {
+        if (node->left != NULL) {
+            node = node->left;
+        } else if (node->right != NULL) {
+            node = node->right;
+        } else {
+            parent = node->parent;
+            if (parent != NULL) {
+                if (parent->left == node) {
+                    parent->left = NULL;
+                } else {
+                    parent->right = NULL;
+                }
+            }
+
+            if (erased) {
+                erase_node(tree, node, free_cb);
+            } else {
+                node_free(tree, node);
+            }
+            count++;
+
+            node = parent;
+        }
+    }
+
+    return count;
+}
+
+/* Erase the keys of [lo, hi] from the small array */
+static unsigned long small_erase(rb_tree_t *tree, rb_key_t lo, rb_key_t hi,
+        rb_free_t free_cb) {
+    rb_small_t *small = tree->small;
+    int first = small_lower_bound(small, lo);
+    int last, i;
+
+    for (last = first; last < small->count && small->keys[last] <= hi; last++) {
+        if (tree->hook != NULL) {
+            tree->hook(tree->hook_ctx, RB_OP_ERASE, small->keys[last], small->nodes[last].value);
+        }
+        if (free_cb != NULL) {
+            free_cb(small->nodes[last].value);
+        }
+    }
+
+    // Close the gap
+    memmove(&small->keys[first], &small->keys[last],
+        (small->count - last) * sizeof(rb_key_t));
+    memmove(&small->nodes[first], &small->nodes[last],
+        (small->count - last) * sizeof(rb_node_t));
+
+    i = last - first;
+    small->count -= i;
+    small_depths(small->depths, 0, small->count - 1, 0);
+    tree->size   -= i;
+
+    return i;
+}
+
+/* Move the keys of a shrunk tree back into its small array */
+static void small_refill(rb_tree_t *tree) {
+    rb_small_t *small = tree->small;
+    rb_node_t *node;
+    int i = 0;
+
+    for (node = rb_first(tree); node != NULL; node = rb_next(tree, node)) {
+        small->keys[i] = node->key;
+        memset(&small->nodes[i], 0, sizeof(rb_node_t));
+        small->nodes[i].key   = node->key;
+        small->nodes[i].value = node->value;
+        i++;
+    }
+
+    // Keys are still there, so nodes go back without reporting
+    drop_subtree(tree, tree->root, 0, NULL);
+
+    tree->root    = NULL;
+    small->count  = i;
+    small->active = 1;
+    small_depths(small->depths, 0, small->count - 1, 0);
+
+    if (tree->dense != NULL) {
+        dense_clear(tree->dense);
+    }
+}
+
+/* Erase all keys in [lo, hi], calling free_cb on each value (may be NULL)
+ * the range is cut out by two splits and one join, so this costs
+ * O(k + log n) for k erased keys instead of k delete fixups
+ * returns the number of erased keys */
+unsigned long rb_erase_range(rb_tree_t *tree, rb_key_t lo, rb_key_t hi, rb_free_t free_cb) {
+    rb_node_t *node;
+    unsigned long count = 0;
+
+    if (lo > hi || tree->size == 0) {
+        return 0;
+    }
+
+    if (tree->small != NULL && tree->small->active) {
+        // Case of small array
+        return small_erase(tree, lo, hi, free_cb);
+    }
+
+#if RB_POLICY == RB_POLICY_SPLAY
+    {
+        rb_node_t *pred = NULL, *succ = NULL;
+        rb_tree_t  sub;
+
+        // Bring the first key above the range to the root,
+        // so everything up to hi is its left sub-tree
+        for (node = tree->root; node != NULL; ) {
+            if (node->key > hi) {
+                succ = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+
+        memset(&sub, 0, sizeof(rb_tree_t));
+        if (succ != NULL) {
+            splay(tree, succ);
+            sub.root = succ->left;
+        } else {
+            sub.root = tree->root;
+        }
+
+        // Then the last key below the range to the root of that,
+        // so the range is its right sub-tree
+        if (sub.root != NULL) {
+            sub.root->parent = NULL;
+        }
+        for (node = sub.root; node != NULL; ) {
+            if (node->key < lo) {
+                pred = node;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+
+        if (pred != NULL) {
+            splay(&sub, pred);
+            node = pred->right;
+            pred->right = NULL;
+        } else {
+            node = sub.root;
+            sub.root = NULL;
+        }
+
+        if (node != NULL) {
+            node->parent = NULL;
+            count = drop_subtree(tree, node, 1, free_cb);
+        }
+
+        // Put the rest back together
+        if (succ != NULL) {
+            succ->left = sub.root;
+            if (sub.root != NULL) {
+                sub.root->parent = succ;
+            }
+        } else {
+            tree->root = sub.root;
+        }
+    }
+#else
+    {
+        rb_node_t *left, *mid, *right, *first, *rest;
+        int lrank, mrank, rrank, rank;
+
+        // [.. lo) lo (lo ..]
+        node = split(tree->root, tree_rank(tree->root), lo, &left, &lrank, &right, &rrank);
+        if (node != NULL) {
+            erase_node(tree, node, free_cb);
+            count++;
+        }
+
+        // (lo .. hi) hi (hi ..]
+        node = split(right, rrank, hi, &mid, &mrank, &right, &rrank);
+        if (node != NULL) {
+            erase_node(tree, node, free_cb);
+            count++;
+        }
+        count += drop_subtree(tree, mid, 1, free_cb);
+
+        // Join what is left, the smallest key of the right part in between
+        if (left == NULL || right == NULL) {
+            tree->root = (left != NULL) ? left : right;
+        } else {
+            for (first = right; first->left != NULL; first = first->left);
+
+            split(right, rrank, first->key, &mid, &mrank, &rest, &rank);
+            tree->root = join(left, lrank, first, rest, rank, &rank);
+        }
+    }
+#endif
+
+    tree->size -= count;
+
+    // Range may have shrunk with the erased keys, density changes either way
+    if (tree->dense != NULL && tree->root != NULL) {
+        for (node = tree->root; node->left  != NULL; node = node->left);
+        tree->dense->min_key = node->key;
+        for (node = tree->root; node->right != NULL; node = node->right);
+        tree->dense->max_key = node->key;
+
+        dense_check(tree, tree->size);
+    }
+
+    // Back to the array once the tree has shrunk well below the threshold
+    if (tree->small != NULL && tree->size <= (unsigned long)tree->small->threshold / 2) {
+        small_refill(tree);
+    }
+
+    return count;
+}
+
+/* Get the node of the smallest key */
+rb_node_t *rb_first(rb_tree_t *tree) {
+    rb_node_t *node = tree->root;
+
+    if (tree->small != NULL && tree->small->active) {
+        return (tree->small->count > 0) ? &tree->small->nodes[0] : NULL;
+    }
+
+    if (node != NULL) {
+        while (node->left != NULL) {
+            node = node->left;
+        }
+    }
+
+    return node;
+}
+
+/* Get the node of the next larger key (NULL after the largest) */
+rb_node_t *rb_next(rb_tree_t *tree, rb_node_t *node) {
+    rb_small_t *small = tree->small;
+
+    if (small != NULL && small->active) {
+        return (node + 1 < &small->nodes[small->count]) ? node + 1 : NULL;
+    }
+
+    if (node->right != NULL) {
+        // Leftmost of the right sub-tree
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    // First ancestor reached from its left
+    while (node->parent != NULL && node->parent->right == node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+/* Get name of the compiled balancing policy */
+const char *rb_policy_name() {
+#if RB_POLICY == RB_POLICY_RB
+    return "red-black";
+#elif RB_POLICY == RB_POLICY_AVL
+    return "avl";
+#elif RB_POLICY == RB_POLICY_TREAP
+    return "treap";
+#elif RB_POLICY == RB_POLICY_SPLAY
+    return "splay";
+#endif
+}
+
+/* Enable hot-key lookup cache (nslots is rounded up to a power of two) */
+int rb_cache_enable(rb_tree_t *tree, int nslots) {
+    rb_cache_t *cache;
+    int bits = 1; // at least two slots, since a shift by 32 is undefined
+
+    if (tree->cache != NULL) {
+        return -1;
+    }
+
+    while ((1 << bits) < nslots && bits < 24) {
+        ++bits;
+    }
+
+    if ((cache = malloc(sizeof(rb_cache_t))) == NULL) {
+        return -1;
+    }
+
+    if ((cache->slots = calloc(1 << bits, sizeof(struct rb_cache_slot_s))) == NULL) {
+        free(cache);
+        return -1;
+    }
+
+    cache->shift  = 32 - bits;
+    cache->hits   = 0;
+    cache->misses = 0;
+
+    tree->cache = cache;
+
+    return 0;
+}
+
+/* Disable hot-key lookup cache */
+void rb_cache_disable(rb_tree_t *tree) {
+    if (tree->cache == NULL) {
+        return;
+    }
+
+    free(tree->cache->slots);
+    free(tree->cache);
+
+    tree->cache = NULL;
+}
+
+/* Get hit/miss counters of the lookup cache */
+void rb_cache_stats(rb_tree_t *tree, unsigned long *hits, unsigned long *misses) {
+    unsigned long h = 0, m = 0;
+
+    if (tree->cache != NULL) {
+        h = tree->cache->hits;
+        m = tree->cache->misses;
+    }
+
+    if (hits   != NULL) *hits   = h;
+    if (misses != NULL) *misses = m;
+}
+
+/* Add keys of the sub-tree to the filter */
+static void filter_add_subtree(rb_filter_t *filter, rb_node_t *node) {
+    while (node != NULL) {
+        filter_add(filter, node->key);
+        filter_add_subtree(filter, node->left);
+        node = node->right;
+    }
+}
+
+/* Enable negative lookup filter
+ * sized for the expected number of keys at the given false positive rate,
+ * but never larger than max_bytes */
+int rb_filter_enable(rb_tree_t *tree, unsigned long expected,
+        double fp_rate, unsigned long max_bytes) {
+    rb_filter_t *filter;
+    double bits;
+    unsigned long bytes;
+    int nhashes, i;
+
+    if (tree->filter != NULL || expected == 0
+            || fp_rate <= 0.0 || fp_rate >= 1.0) {
+        return -1;
+    }
+
+    // Optimal size: m = -n ln(p) / ln(2)^2
+    bits  = -(double)expected * log(fp_rate) / (M_LN2 * M_LN2);
+    bytes = (unsigned long)(bits / 8) + 1;
+
+    if (bytes > max_bytes) {
+        bytes = max_bytes;
+    }
+
+    // Round to whole blocks (at least one)
+    bytes = (bytes + 63) / 64 * 64;
+    if (bytes == 0) {
+        bytes = 64;
+    }
+
+    // Optimal number of hashes for the size we actually got: k = m/n ln(2)
+    nhashes = (int)((double)bytes * 8 / expected * M_LN2 + 0.5);
+    if (nhashes < 1)                 nhashes = 1;
+    if (nhashes > FILTER_MAX_HASHES) nhashes = FILTER_MAX_HASHES;
+
+    if ((filter = malloc(sizeof(rb_filter_t))) == NULL) {
+        return -1;
+    }
+
+    if ((filter->blocks = aligned_alloc(64, bytes)) == NULL) {
+        free(filter);
+        return -1;
+    }
+
+    memset(filter->blocks, 0, bytes);
+
+    filter->nblocks = bytes / 64;
+    filter->nhashes = nhashes;
+    filter->rejects = 0;
+
+    // Keys inserted before enabling must pass the filter too
+    filter_add_subtree(filter, tree->root);
+
+    if (tree->small != NULL) {
+        for (i = 0; i < tree->small->count; i++) {
+            filter_add(filter, tree->small->keys[i]);
+        }
+    }
+
+    tree->filter = filter;
+
+    return 0;
+}
+
+/* Disable negative lookup filter */
+void rb_filter_disable(rb_tree_t *tree) {
+    if (tree->filter == NULL) {
+        return;
+    }
+
+    free(tree->filter->blocks);
+    free(tree->filter);
+
+    tree->filter = NULL;
+}
+
+/* Get number of lookups rejected by the filter */
+unsigned long rb_filter_rejects(rb_tree_t *tree) {
+    return (tree->filter != NULL) ? tree->filter->rejects : 0;
+}
+
+/* Enable dense direct index
+ * it switches in once size / (max_key - min_key + 1) reaches min_density
+ * and out below half of it (an allocation failure holds it off until the
+ * tree doubles),
+ * then rb_get is one page table probe; rb_find still searches the tree
+ * (behind the filter and cache) since it has to report the depth */
+int rb_dense_enable(rb_tree_t *tree, double min_density) {
+    rb_dense_t *dense;
+    rb_node_t  *node;
+
+    if (tree->dense != NULL || min_density <= 0.0) {
+        return -1;
+    }
+
+    if ((dense = malloc(sizeof(rb_dense_t))) == NULL) {
+        return -1;
+    }
+
+    memset(dense, 0, sizeof(rb_dense_t));
+    dense->min_density = min_density;
+
+    // Key range of existing keys
+    if (tree->root != NULL) {
+        for (node = tree->root; node->left  != NULL; node = node->left);
+        dense->min_key = node->key;
+        for (node = tree->root; node->right != NULL; node = node->right);
+        dense->max_key = node->key;
+    }
+
+    tree->dense = dense;
+    dense_check(tree, tree->size);
+
+    return 0;
+}
+
+/* Disable dense direct index */
+void rb_dense_disable(rb_tree_t *tree) {
+    if (tree->dense == NULL) {
+        return;
+    }
+
+    dense_clear(tree->dense);
+    free(tree->dense);
+
+    tree->dense = NULL;
+}
+
+/* Check whether lookups are served by the dense index */
+int rb_dense_active(rb_tree_t *tree) {
+    return tree->dense != NULL && tree->dense->active;
 }
@@ -3,6 +3,19 @@
 
 typedef unsigned int rb_key_t;
 
+// Balancing policy, chosen at compile time (e.g. -DRB_POLICY=RB_POLICY_AVL)
+#define RB_POLICY_RB        0   // red-black : cheap fixups, for write-heavy use
+#define RB_POLICY_AVL       1   // AVL       : shallower trees, for lookup-heavy use
+#define RB_POLICY_TREAP     2   // treap     : randomized, no balance bookkeeping
+#define RB_POLICY_SPLAY     3   // splay     : recently used keys move to the root
+
+#ifndef RB_POLICY
+#define RB_POLICY   RB_POLICY_RB
+#endif
+
+#define RB_SMALL_MAX        32  // largest threshold of the small array mode
+#define RB_SMALL_MIN        4   // first capacity of the small array, doubled as it fills
+
 // Red-Black Node structure
 struct rb_node_s {
     struct rb_node_s *parent;
@@ -11,23 +24,148 @@ struct rb_node_s {
 
     rb_key_t key;
     void    *value;
-    int      color; // 0(RED) or 1(BLACK)
+    union {
+        int          color;     // RB    : 0(RED) or 1(BLACK)
+        int          height;    // AVL   : height of sub-tree (leaf is 1)
+        unsigned int priority;  // Treap : parent has higher priority
+    };
+};
+
+// Hot-key cache slot (remembers where a key was found)
+struct rb_cache_slot_s {
+    rb_key_t          key;
+    struct rb_node_s *node;  // NULL if empty, cleared when the node is freed
+};
+
+// Hot-key lookup cache (direct-mapped, key -> node)
+// rotations keep nodes in place, so only freeing a node drops its slot
+struct rb_cache_s {
+    struct rb_cache_slot_s *slots;
+    int           shift;     // 32 - log2(number of slots)
+
+    unsigned long hits;
+    unsigned long misses;
+};
+
+// Blocked Bloom filter (each block is one 64-byte cache line)
+struct rb_filter_s {
+    unsigned long long *blocks;
+    unsigned long       nblocks;
+    int                 nhashes;   // bits set per key, all in one block
+
+    unsigned long       rejects;   // lookups answered without the tree
+};
+
+// Dense direct index (paged key -> node table over a bounded key range)
+struct rb_dense_s {
+    struct rb_node_s ***pages;      // allocated on first key in the page
+    rb_key_t            base;       // key of first slot of first page
+    unsigned long       npages;
+
+    double              min_density; // switch in at size / key range >= this, out below half
+    int                 active;     // 0 while the range is still too sparse
+    unsigned long       retry_size; // after a failed switch in, no retry below this size
+    rb_key_t            min_key;    // key range seen so far
+    rb_key_t            max_key;
+};
+
+// Small sorted array (holds the keys while the tree is tiny)
+struct rb_small_s {
+    int              active;    // 1 while keys live in the array
+    int              count;
+    int              threshold; // converts to nodes past this many keys
+    int              capacity;  // allocated node slots, up to threshold
+
+    rb_key_t         *keys;     // scanned by lookups, inline right after this header
+    unsigned char    *depths;   // depth of each position in the implied balanced tree (inline)
+    struct rb_node_s *nodes;    // key and value only, no links (grown as needed)
 };
 
 // Red-Black Tree structure
 struct rb_tree_s {
-    struct rb_node_s *root;
+    struct rb_node_s   *root;
+    unsigned long       size;   // number of keys
+    struct rb_cache_s  *cache;  // optional, NULL if disabled
+    struct rb_filter_s *filter; // optional, NULL if disabled
+    struct rb_dense_s  *dense;  // optional, NULL if disabled
+    struct rb_small_s  *small;  // set by rb_create_small(), placed right after
+
+    struct rb_node_s   *pool;   // fixed-capacity tree takes nodes from here
+    unsigned long       capacity;
+    unsigned long       used;       // pool nodes handed out so far
+    struct rb_node_s   *free_nodes; // pool nodes given back by erase (linked by right)
+
+    // Called after every change of the keys (e.g. by the write-ahead log)
+    void              (*hook)(void *ctx, int op, rb_key_t key, void *value);
+    void               *hook_ctx;
 };
 
+// Results of rb_insert (0 on success)
+#define RB_EXISTS       -1  // key is already in the tree
+#define RB_FULL         -2  // no node to hold the key (fixed pool exhausted, or out of memory)
+
+// Operations reported to the hook
+#define RB_OP_INSERT    1
+#define RB_OP_ERASE     2
+
+// Fixed-capacity tree in static storage, ready without any call or heap
+//   static rb_node_t tier_nodes[16];
+//   static rb_tree_t tiers = RB_FIXED_INIT(tier_nodes);
+#define RB_FIXED_INIT(nodes) \
+    { .pool = (nodes), .capacity = sizeof(nodes) / sizeof((nodes)[0]) }
+
 typedef struct rb_node_s rb_node_t;
 typedef struct rb_tree_s rb_tree_t;
+typedef struct rb_cache_s rb_cache_t;
+typedef struct rb_filter_s rb_filter_t;
+typedef struct rb_dense_s rb_dense_t;
+typedef struct rb_small_s rb_small_t;
+
+// Called on each value removed by erase
+typedef void (*rb_free_t)(void *value);
+
+// Callbacks of parallel traversal
+typedef void (*rb_visit_t)(rb_node_t *node, void *acc);
+typedef void (*rb_reduce_t)(void *acc, void *part);
 
 
 // Red-Black Tree implementation
 rb_tree_t  *rb_create();
+rb_tree_t  *rb_create_small(int threshold);
+void        rb_init_fixed(rb_tree_t *tree, rb_node_t *pool, unsigned long capacity);
 rb_node_t  *rb_create_node();
 int         rb_insert(rb_tree_t *tree, rb_key_t ikey, void *value);
+#if RB_POLICY == RB_POLICY_RB
 void        rb_remedy_double_red(rb_tree_t *tree, rb_node_t *node);
+#endif
 int         rb_find(rb_tree_t *tree, rb_key_t skey, rb_node_t **node);
+void        rb_find_batch(rb_tree_t *tree, const rb_key_t *skeys, int n,
+                int *depths, rb_node_t **found);
+rb_node_t  *rb_get(rb_tree_t *tree, rb_key_t skey);
+unsigned long rb_erase_range(rb_tree_t *tree, rb_key_t lo, rb_key_t hi, rb_free_t free_cb);
+rb_node_t  *rb_first(rb_tree_t *tree);
+rb_node_t  *rb_next(rb_tree_t *tree, rb_node_t *node);
+const char *rb_policy_name();
+
+// Parallel traversal (rbt_parallel.c, link with -lpthread)
+int         rb_foreach_parallel(rb_tree_t *tree, rb_visit_t fn, rb_reduce_t reduce,
+                void *acc, int acc_size, int nthreads);
+void        rb_parallel_shutdown();
+
+// Hot-key lookup cache
+int         rb_cache_enable(rb_tree_t *tree, int nslots);
+void        rb_cache_disable(rb_tree_t *tree);
+void        rb_cache_stats(rb_tree_t *tree, unsigned long *hits, unsigned long *misses);
+
+// Negative lookup filter
+int         rb_filter_enable(rb_tree_t *tree, unsigned long expected,
+                double fp_rate, unsigned long max_bytes);
+void        rb_filter_disable(rb_tree_t *tree);
+unsigned long rb_filter_rejects(rb_tree_t *tree);
+
+// Dense direct index (serves rb_get; rb_find keeps searching for the depth)
+int         rb_dense_enable(rb_tree_t *tree, double min_density);
+void        rb_dense_disable(rb_tree_t *tree);
+int         rb_dense_active(rb_tree_t *tree);
 
 #endif
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rbt_disk.h"
+
+#define RED     0
+#define BLACK   1
+
+#define DISK_MAGIC  0x31444252  // "RBD1"
+
+// Header page layout
+struct disk_header_s {
+    unsigned int magic;
+    rb_disk_id_t root;
+    rb_disk_id_t nnodes;
+};
+
+/* Make the page table cover the page */
+static int page_table_grow(rb_disk_t *disk, unsigned int page) {
+    unsigned int npages = disk->npages;
+    int *frame_of;
+
+    if (page < npages) {
+        return 0;
+    }
+
+    while (npages <= page) {
+        npages = (npages == 0) ? 1024 : npages * 2;
+    }
+
+    if ((frame_of = realloc(disk->frame_of, npages * sizeof(int))) == NULL) {
+        return -1;
+    }
+
+    memset(frame_of + disk->npages, -1, (npages - disk->npages) * sizeof(int));
+
+    disk->frame_of = frame_of;
+    disk->npages   = npages;
+
+    return 0;
+}
+
+/* Write the frame back to the file if it has been modified */
+static int frame_flush(rb_disk_t *disk, rb_disk_frame_t *frame) {
+    if (!frame->used || !frame->dirty) {
+        return 0;
+    }
+
+    if (pwrite(disk->fd, frame->data, RB_DISK_PAGE_SIZE,
+            (off_t)frame->page * RB_DISK_PAGE_SIZE) != RB_DISK_PAGE_SIZE) {
+        return -1;
+    }
+
+    frame->dirty = 0;
+
+    return 0;
+}
+
+/* Choose a frame to reuse by clock replacement */
+static rb_disk_frame_t *frame_victim(rb_disk_t *disk) {
+    rb_disk_frame_t *frame;
+
+    // At most half of the frames are pinned, so this terminates
+    while (1) {
+        frame = &disk->frames[disk->hand];
+        disk->hand = (disk->hand + 1) % disk->nframes;
+
+        if (!frame->used) {
+            return frame;
+        }
+
+        if (frame->pinned == disk->pin_epoch) {
+            continue;
+        }
+
+        if (frame->ref) {
+            // Second chance
+            frame->ref = 0;
+            continue;
+        }
+
+        return frame;
+    }
+}
+
+/* Get the page through the buffer pool (fresh pages are not read) */
+static char *page_fetch(rb_disk_t *disk, unsigned int page, int fresh) {
+    rb_disk_frame_t *frame;
+    ssize_t n;
+
+    if (page_table_grow(disk, page) == -1) {
+        return NULL;
+    }
+
+    // Hit
+    if (disk->frame_of[page] != -1) {
+        frame = &disk->frames[disk->frame_of[page]];
+        frame->ref = 1;
+
+        return frame->data;
+    }
+
+    // Miss, evict a page
+    frame = frame_victim(disk);
+
+    if (frame->used) {
+        if (frame_flush(disk, frame) == -1) {
+            return NULL;
+        }
+        disk->frame_of[frame->page] = -1;
+    }
+
+    if (fresh) {
+        memset(frame->data, 0, RB_DISK_PAGE_SIZE);
+        frame->dirty = 1;
+
+    } else {
+        n = pread(disk->fd, frame->data, RB_DISK_PAGE_SIZE,
+                (off_t)page * RB_DISK_PAGE_SIZE);
+        if (n < 0) {
+            return NULL;
+        }
+
+        // Short read is a page never written back yet
+        memset(frame->data + n, 0, RB_DISK_PAGE_SIZE - n);
+        frame->dirty = 0;
+
+        disk->faults++;
+    }
+
+    frame->page   = page;
+    frame->used   = 1;
+    frame->ref    = 1;
+    frame->pinned = 0;
+
+    disk->frame_of[page] = frame - disk->frames;
+
+    return frame->data;
+}
+
+/* Get page number of the node */
+static unsigned int node_page(rb_disk_id_t id) {
+    return 1 + (id - 1) / RB_DISK_PAGE_NODES;
+}
+
+/* Get the node for reading (pointer is valid until the next fetch, NULL on error) */
+static rb_disk_node_t *node_rd(rb_disk_t *disk, rb_disk_id_t id) {
+    char *data = page_fetch(disk, node_page(id), 0);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    return (rb_disk_node_t *)(data + ((id - 1) % RB_DISK_PAGE_NODES) * RB_DISK_NODE_SIZE);
+}
+
+/* Get the node for writing (pointer is valid until the next fetch, NULL on error) */
+static rb_disk_node_t *node_wr(rb_disk_t *disk, rb_disk_id_t id) {
+    rb_disk_node_t *node = node_rd(disk, id);
+
+    if (node != NULL) {
+        disk->frames[disk->frame_of[node_page(id)]].dirty = 1;
+    }
+
+    return node;
+}
+
+/* Copy the node out of the pool (stays valid across fetches) */
+static int node_load(rb_disk_t *disk, rb_disk_id_t id, rb_disk_node_t *copy) {
+    rb_disk_node_t *node = node_rd(disk, id);
+
+    if (node == NULL) {
+        return -1;
+    }
+
+    *copy = *node;
+
+    return 0;
+}
+
+/* Set color of the node */
+static int node_paint(rb_disk_t *disk, rb_disk_id_t id, int color) {
+    rb_disk_node_t *node = node_wr(disk, id);
+
+    if (node == NULL) {
+        return -1;
+    }
+
+    node->color = color;
+
+    return 0;
+}
+
+/* Get the node reached at the depth, pinning upper levels (NULL on error) */
+static rb_disk_node_t *node_at(rb_disk_t *disk, rb_disk_id_t id, int depth) {
+    rb_disk_node_t  *node  = node_rd(disk, id);
+    rb_disk_frame_t *frame;
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    frame = &disk->frames[disk->frame_of[node_page(id)]];
+
+    if (depth < disk->pin_levels && frame->pinned != disk->pin_epoch
+            && disk->npinned < disk->nframes / 2) {
+        frame->pinned = disk->pin_epoch;
+        disk->npinned++;
+    }
+
+    return node;
+}
+
+/* Unpin all frames, lookups pin the pages of the new upper levels again */
+static void unpin_all(rb_disk_t *disk) {
+    disk->pin_epoch++;
+    disk->npinned = 0;
+}
+
+/* Get color of the node (NULL is BLACK, -1 on error) */
+static int color_of(rb_disk_t *disk, rb_disk_id_t id) {
+    rb_disk_node_t *node;
+
+    if (id == 0) {
+        return BLACK;
+    }
+
+    return ((node = node_rd(disk, id)) == NULL) ? -1 : node->color;
+}
+
+/* Rotate the node above its parent */
+static int rotate_up(rb_disk_t *disk, rb_disk_id_t id) {
+    rb_disk_node_t node, parent;
+    rb_disk_node_t *w;
+    rb_disk_id_t child;
+    int right;
+
+    if (node_load(disk, id, &node) == -1
+            || node_load(disk, node.parent, &parent) == -1) {
+        return -1;
+    }
+
+    // Right rotation if the node is the left child, left rotation otherwise
+    right = (parent.left == id);
+    child = right ? node.right : node.left;
+
+    if ((w = node_wr(disk, node.parent)) == NULL) {
+        return -1;
+    }
+    if (right) w->left  = child;
+    else       w->right = child;
+    w->parent = id;
+
+    if ((w = node_wr(disk, id)) == NULL) {
+        return -1;
+    }
+    if (right) w->right = node.parent;
+    else       w->left  = node.parent;
+    w->parent = parent.parent;
+
+    if (child != 0) {
+        if ((w = node_wr(disk, child)) == NULL) {
+            return -1;
+        }
+        w->parent = node.parent;
+    }
+
+    // Connect with ancestor
+    if (parent.parent == 0) {
+        disk->root = id;
+    } else {
+        if ((w = node_wr(disk, parent.parent)) == NULL) {
+            return -1;
+        }
+        if (w->left == node.parent) w->left  = id;
+        else                        w->right = id;
+    }
+
+    return 0;
+}
+
+/* Remedy the double red situation (same recoloring/restructuring as rbt.c)
+ * depth is that of the node, to tell whether pinned upper levels move */
+static int remedy_double_red(rb_disk_t *disk, rb_disk_id_t id, int depth) {
+    rb_disk_node_t node, parent, grand;
+    rb_disk_id_t pid, gid, uid;
+    int uncle_color;
+
+    while (1) {
+        if (node_load(disk, id, &node) == -1) {
+            return -1;
+        }
+        if ((pid = node.parent) == 0) {
+            break;
+        }
+        if (node_load(disk, pid, &parent) == -1) {
+            return -1;
+        }
+        if (parent.color != RED) {
+            break;
+        }
+
+        // RED parent is never the root, so the grand parent exists
+        gid = parent.parent;
+        if (node_load(disk, gid, &grand) == -1) {
+            return -1;
+        }
+        uid = (grand.left == pid) ? grand.right : grand.left;
+
+        if ((uncle_color = color_of(disk, uid)) == -1) {
+            return -1;
+        }
+
+        if (uncle_color == RED) {
+            // Recoloring, double red may propagate to the grand parent
+            if (node_paint(disk, pid, BLACK) == -1
+                    || node_paint(disk, uid, BLACK) == -1
+                    || node_paint(disk, gid, RED) == -1) {
+                return -1;
+            }
+            id     = gid;
+            depth -= 2;
+
+        } else {
+            // Restructuring reshapes the sub-tree of the grand parent
+            if (depth - 2 < disk->pin_levels) {
+                unpin_all(disk);
+            }
+
+            // Middle key becomes the BLACK sub-tree root
+            if ((grand.left == pid) != (parent.left == id)) {
+                if (rotate_up(disk, id) == -1) {
+                    return -1;
+                }
+                pid = id;
+            }
+            if (rotate_up(disk, pid) == -1
+                    || node_paint(disk, pid, BLACK) == -1
+                    || node_paint(disk, gid, RED) == -1) {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return node_paint(disk, disk->root, BLACK);
+}
+
+/* Open (or create) disk-backed tree in the file */
+rb_disk_t *rb_disk_open(const char *path, int pool_pages, int pin_levels) {
+    rb_disk_t *disk;
+    struct disk_header_s header;
+    char *data;
+    int i;
+
+    if (pool_pages < 2) {
+        return NULL;
+    }
+
+    if ((disk = malloc(sizeof(rb_disk_t))) == NULL) {
+        return NULL;
+    }
+
+    memset(disk, 0, sizeof(rb_disk_t));
+    disk->nframes    = pool_pages;
+    disk->pin_levels = pin_levels;
+    disk->pin_epoch  = 1;
+
+    if ((disk->fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+        free(disk);
+        return NULL;
+    }
+
+    disk->frames = calloc(pool_pages, sizeof(rb_disk_frame_t));
+    data         = malloc((size_t)pool_pages * RB_DISK_PAGE_SIZE);
+
+    if (disk->frames == NULL || data == NULL) {
+        free(disk->frames);
+        free(data);
+        close(disk->fd);
+        free(disk);
+        return NULL;
+    }
+
+    for (i = 0; i < pool_pages; i++) {
+        disk->frames[i].data = data + (size_t)i * RB_DISK_PAGE_SIZE;
+    }
+
+    // Existing tree
+    if (pread(disk->fd, &header, sizeof(header), 0) == sizeof(header)
+            && header.magic == DISK_MAGIC) {
+        disk->root   = header.root;
+        disk->nnodes = header.nnodes;
+    }
+
+    return disk;
+}
+
+/* Write back all pages and the header, then close the file */
+int rb_disk_close(rb_disk_t *disk) {
+    struct disk_header_s header;
+    int i, ret = 0;
+
+    for (i = 0; i < disk->nframes; i++) {
+        if (frame_flush(disk, &disk->frames[i]) == -1) {
+            ret = -1;
+        }
+    }
+
+    header.magic  = DISK_MAGIC;
+    header.root   = disk->root;
+    header.nnodes = disk->nnodes;
+
+    if (pwrite(disk->fd, &header, sizeof(header), 0) != sizeof(header)
+            || fsync(disk->fd) == -1) {
+        ret = -1;
+    }
+
+    close(disk->fd);
+
+    free(disk->frames[0].data);
+    free(disk->frames);
+    free(disk->frame_of);
+    free(disk);
+
+    return ret;
+}
+
+/* Insert {key, value} pair to tree (-1 if it exists, -2 on I/O error) */
+int rb_disk_insert(rb_disk_t *disk, rb_key_t ikey, unsigned long long value) {
+    rb_disk_node_t *node;
+    rb_disk_id_t vacant, parent = 0, id;
+    int depth = 0, left = 0;
+
+    // Find the vacant
+    vacant = disk->root;
+    while (vacant != 0) {
+        parent = vacant;
+        if ((node = node_at(disk, vacant, depth++)) == NULL) {
+            return -2;
+        }
+
+        if (ikey < node->key) {
+            vacant = node->left;
+            left   = 1;
+        } else if (ikey > node->key) {
+            vacant = node->right;
+            left   = 0;
+        } else {
+            // Already exists
+            return -1;
+        }
+    }
+
+    // Create node on the vacant (first node of a page starts a fresh page)
+    id = disk->nnodes + 1;
+    if ((id - 1) % RB_DISK_PAGE_NODES == 0
+            && page_fetch(disk, node_page(id), 1) == NULL) {
+        return -2;
+    }
+    if ((node = node_wr(disk, id)) == NULL) {
+        return -2;
+    }
+    disk->nnodes = id;
+
+    memset(node, 0, sizeof(rb_disk_node_t));
+    node->parent = parent;
+    node->key    = ikey;
+    node->value  = value;
+    node->color  = RED;
+
+    // Setup child pointer of parent
+    if (parent == 0) {
+        disk->root = id;
+    } else {
+        if ((node = node_wr(disk, parent)) == NULL) {
+            return -2;
+        }
+        if (left) node->left  = id;
+        else      node->right = id;
+    }
+
+    // Load balancing
+    return (remedy_double_red(disk, id, depth) == -1) ? -2 : 0;
+}
+
+/* Find the key, returning its depth (-1 if absent, -2 on I/O error) */
+int rb_disk_find(rb_disk_t *disk, rb_key_t skey, unsigned long long *value) {
+    rb_disk_node_t *node;
+    rb_disk_id_t id = disk->root;
+    int depth = 0;
+
+    disk->lookups++;
+
+    while (id != 0) {
+        if ((node = node_at(disk, id, depth)) == NULL) {
+            return -2;
+        }
+
+        if (skey == node->key) { // find!
+            if (value != NULL) {
+                *value = node->value;
+            }
+            return depth;
+        } else if (skey < node->key) { // go left
+            id = node->left;
+        } else { // go right
+            id = node->right;
+        }
+        ++depth;
+    }
+
+    return -1;
+}
+
+/* Get page faults and lookups counted so far */
+void rb_disk_stats(rb_disk_t *disk, unsigned long *faults, unsigned long *lookups) {
+    if (faults  != NULL) *faults  = disk->faults;
+    if (lookups != NULL) *lookups = disk->lookups;
+}
+
+/* Reset the counters */
+void rb_disk_reset_stats(rb_disk_t *disk) {
+    disk->faults  = 0;
+    disk->lookups = 0;
+}
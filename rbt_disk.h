@@ -0,0 +1,71 @@
+#ifndef __RBT_DISK_H__
+#define __RBT_DISK_H__
+
+#include "rbt.h"
+
+#define RB_DISK_PAGE_SIZE   4096
+#define RB_DISK_NODE_SIZE   32      // on-disk node record
+#define RB_DISK_PAGE_NODES  (RB_DISK_PAGE_SIZE / RB_DISK_NODE_SIZE)
+
+typedef unsigned int rb_disk_id_t;  // node number, 0 means NULL
+
+// On-disk node record (links are node numbers, not pointers)
+struct rb_disk_node_s {
+    rb_disk_id_t parent;
+    rb_disk_id_t left;
+    rb_disk_id_t right;
+
+    rb_key_t     key;
+    unsigned long long value;   // stored verbatim, must not be a pointer
+    int          color;         // 0(RED) or 1(BLACK)
+    int          reserved;
+};
+
+// Buffer pool frame (holds one page of the file)
+struct rb_disk_frame_s {
+    unsigned int page;      // page number in the file
+    char         used;
+    char         ref;       // clock reference bit
+    char         dirty;     // must be written back before eviction
+    unsigned long pinned;   // holds an upper level while equal to pin_epoch
+    char        *data;
+};
+
+// Disk-backed Red-Black Tree
+struct rb_disk_s {
+    int          fd;
+
+    // Header (page 0 of the file)
+    rb_disk_id_t root;
+    rb_disk_id_t nnodes;
+
+    // Buffer pool
+    struct rb_disk_frame_s *frames;
+    int          nframes;
+    int          npinned;
+    int          hand;          // clock hand
+    int          pin_levels;    // pages reached above this depth get pinned
+    unsigned long pin_epoch;    // bumped to unpin all when upper levels rotate
+
+    int         *frame_of;      // page number -> frame (-1 if not cached)
+    unsigned int npages;        // capacity of frame_of
+
+    // Statistics
+    unsigned long faults;       // pages read from the file
+    unsigned long lookups;
+};
+
+typedef struct rb_disk_node_s  rb_disk_node_t;
+typedef struct rb_disk_frame_s rb_disk_frame_t;
+typedef struct rb_disk_s       rb_disk_t;
+
+
+// Disk-backed Red-Black Tree implementation
+rb_disk_t  *rb_disk_open(const char *path, int pool_pages, int pin_levels);
+int         rb_disk_close(rb_disk_t *disk);
+int         rb_disk_insert(rb_disk_t *disk, rb_key_t ikey, unsigned long long value);
+int         rb_disk_find(rb_disk_t *disk, rb_key_t skey, unsigned long long *value);
+void        rb_disk_stats(rb_disk_t *disk, unsigned long *faults, unsigned long *lookups);
+void        rb_disk_reset_stats(rb_disk_t *disk);
+
+#endif
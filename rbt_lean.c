@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rbt_lean.h"
+
+#define RED     0
+#define BLACK   1
+
+/* Create lean Red-Black Tree */
+rb_lean_tree_t *rb_lean_create() {
+    rb_lean_tree_t *tree = NULL;
+
+    if ((tree = malloc(sizeof(rb_lean_tree_t))) == NULL) {
+        return NULL;
+    }
+
+    tree->root = NULL;
+    tree->size = 0;
+
+    return tree;
+}
+
+/* Restructure the sub-tree of grand (path[i] is the RED child of RED parent)
+ * same result as restructuring() of rbt.c */
+static void restructuring(rb_lean_tree_t *tree, rb_lean_node_t **path, int i) {
+    rb_lean_node_t *node   = path[i];
+    rb_lean_node_t *parent = path[i-1];
+    rb_lean_node_t *grand  = path[i-2];
+    rb_lean_node_t *p, *l, *r, *lrc, *rlc;
+
+    if (grand->left == parent) {
+        if (parent->left == node) {
+            // left-left
+            l = node;   r = grand;  p = parent;
+            lrc = node->right;      rlc = parent->right;
+        } else {
+            // left-right
+            l = parent; r = grand;  p = node;
+            lrc = node->left;       rlc = node->right;
+        }
+    } else {
+        if (parent->left == node) {
+            // right-left
+            l = grand;  r = parent; p = node;
+            lrc = node->left;       rlc = node->right;
+        } else {
+            // right-right
+            l = grand;  r = node;   p = parent;
+            lrc = parent->left;     rlc = node->left;
+        }
+    }
+
+    // Change color
+    p->color = BLACK;
+    l->color = RED;
+    r->color = RED;
+
+    // Renew child pointers
+    p->left  = l;
+    p->right = r;
+    l->right = lrc;
+    r->left  = rlc;
+
+    // Connect with ancestor (taken from the path instead of a parent pointer)
+    if (i == 2) {
+        tree->root = p;
+    } else if (path[i-3]->left == grand) {
+        path[i-3]->left  = p;
+    } else {
+        path[i-3]->right = p;
+    }
+}
+
+/* Insert {key, value} pair to tree
+ * returns 0, RB_EXISTS if the key is already there, or RB_FULL */
+int rb_lean_insert(rb_lean_tree_t *tree, rb_key_t ikey, void *value) {
+    rb_lean_node_t *path[RB_LEAN_MAX_DEPTH + 1];
+    rb_lean_node_t *node, *parent, *grand, *uncle;
+    int i = 0;
+
+    // Find the vacant, remembering the way down
+    for (node = tree->root; node != NULL; ) {
+        if (i == RB_LEAN_MAX_DEPTH) {
+            // No room left on the path (not for a valid tree)
+            return RB_FULL;
+        }
+        path[i++] = node;
+
+        if (ikey < node->key) {
+            node = node->left;
+        } else if (ikey > node->key) {
+            node = node->right;
+        } else {
+            // Already exists
+            return RB_EXISTS;
+        }
+    }
+
+    // Create node on the vacant
+    if ((node = malloc(sizeof(rb_lean_node_t))) == NULL) {
+        return RB_FULL;
+    }
+
+    node->left  = NULL;
+    node->right = NULL;
+    node->key   = ikey;
+    node->value = value;
+    node->color = (i == 0) ? BLACK : RED;
+
+    if (i == 0) {
+        tree->root = node;
+    } else if (ikey < path[i-1]->key) {
+        path[i-1]->left  = node;
+    } else {
+        path[i-1]->right = node;
+    }
+    path[i] = node;
+
+    tree->size++;
+
+    // Remedy double red, walking up the path instead of recursing
+    while (i >= 2 && path[i-1]->color == RED) {
+        parent = path[i-1];
+        grand  = path[i-2];
+        uncle  = (grand->left == parent) ? grand->right : grand->left;
+
+        if (uncle == NULL || uncle->color == BLACK) {
+            // Restructuring doesn't propagate
+            restructuring(tree, path, i);
+            break;
+        }
+
+        // Recoloring
+        parent->color = BLACK;
+        uncle->color  = BLACK;
+
+        // Root remains BLACK, so there is no propagation from it
+        if (i == 2) {
+            break;
+        }
+
+        grand->color = RED;
+        i -= 2;
+    }
+
+    return 0;
+}
+
+/* Find the node */
+int rb_lean_find(rb_lean_tree_t *tree, rb_key_t skey, rb_lean_node_t **found) {
+    rb_lean_node_t *node = tree->root;
+    int depth = 0;
+
+    while (node != NULL) {
+        if (skey == node->key) { // find!
+            break;
+        } else if (skey < node->key) { // go left
+            node = node->left;
+        } else { // go right
+            node = node->right;
+        }
+        ++depth;
+    }
+
+    if (found != NULL) {
+        *found = node;
+    }
+
+    return (node == NULL) ? -1 : depth;
+}
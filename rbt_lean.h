@@ -0,0 +1,33 @@
+#ifndef __RBT_LEAN_H__
+#define __RBT_LEAN_H__
+
+#include "rbt.h"
+
+#define RB_LEAN_MAX_DEPTH   96  // red-black height is below 2 * log2(n + 1)
+
+// Red-Black Node without parent pointer (32 bytes instead of 48)
+struct rb_lean_node_s {
+    struct rb_lean_node_s *left;
+    struct rb_lean_node_s *right;
+
+    rb_key_t key;
+    int      color; // 0(RED) or 1(BLACK)
+    void    *value;
+};
+
+// Red-Black Tree of lean nodes
+struct rb_lean_tree_s {
+    struct rb_lean_node_s *root;
+    unsigned long          size;
+};
+
+typedef struct rb_lean_node_s rb_lean_node_t;
+typedef struct rb_lean_tree_s rb_lean_tree_t;
+
+
+// Lean Red-Black Tree implementation
+rb_lean_tree_t *rb_lean_create();
+int             rb_lean_insert(rb_lean_tree_t *tree, rb_key_t ikey, void *value);
+int             rb_lean_find(rb_lean_tree_t *tree, rb_key_t skey, rb_lean_node_t **found);
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "rbt_learned.h"
+
+/* Get depth of the node as rb_find reports it */
+static int node_depth(rb_tree_t *tree, rb_node_t *node) {
+    int depth = 0;
+
+    // Array positions are not tree depths, ask the array search
+    if (tree->small != NULL && tree->small->active) {
+        return rb_find(tree, node->key, NULL);
+    }
+
+    while (node->parent != NULL) {
+        node = node->parent;
+        ++depth;
+    }
+
+    return depth;
+}
+
+/* Cut the sorted keys into segments, each predicted within max_error
+ * (greedy shrinking cone, a segment grows while some slope still fits) */
+static int build_segments(rb_learned_t *learned) {
+    rb_key_t *keys = learned->keys;
+    double err = learned->max_error;
+    double lo, hi, dx, dy;
+    unsigned long start, i, cap = 64;
+    rb_key_t *seg_keys;
+    rb_learned_seg_t *segs;
+
+    learned->seg_keys = malloc(cap * sizeof(rb_key_t));
+    learned->segs     = malloc(cap * sizeof(rb_learned_seg_t));
+    learned->nsegs    = 0;
+
+    if (learned->seg_keys == NULL || learned->segs == NULL) {
+        return -1;
+    }
+
+    for (start = 0; start < learned->size; start = i) {
+        lo = 0.0;
+        hi = HUGE_VAL;
+
+        for (i = start + 1; i < learned->size; i++) {
+            dx = (double)(keys[i] - keys[start]);
+            dy = (double)(i - start);
+
+            if ((dy + err) / dx < lo || (dy - err) / dx > hi) {
+                break;
+            }
+            if ((dy + err) / dx < hi) hi = (dy + err) / dx;
+            if ((dy - err) / dx > lo) lo = (dy - err) / dx;
+        }
+
+        if (learned->nsegs == cap) {
+            cap *= 2;
+
+            // Old arrays stay with the index (and are freed with it) on failure
+            if ((seg_keys = realloc(learned->seg_keys, cap * sizeof(rb_key_t))) == NULL) {
+                return -1;
+            }
+            learned->seg_keys = seg_keys;
+
+            if ((segs = realloc(learned->segs, cap * sizeof(rb_learned_seg_t))) == NULL) {
+                return -1;
+            }
+            learned->segs = segs;
+        }
+
+        learned->seg_keys[learned->nsegs]    = keys[start];
+        learned->segs[learned->nsegs].slope  = (hi == HUGE_VAL) ? 0.0 : (lo + hi) / 2;
+        learned->segs[learned->nsegs].start  = start;
+        learned->segs[learned->nsegs].end    = i;
+        learned->nsegs++;
+    }
+
+    return 0;
+}
+
+/* Build the learned index from the current keys of the tree
+ * the tree must not change (nor be splayed) while the index is used */
+rb_learned_t *rb_learned_build(rb_tree_t *tree, int max_error) {
+    rb_learned_t *learned;
+    rb_node_t *node;
+    unsigned long i = 0;
+
+    if (max_error < 1 || (learned = malloc(sizeof(rb_learned_t))) == NULL) {
+        return NULL;
+    }
+
+    memset(learned, 0, sizeof(rb_learned_t));
+    learned->max_error = max_error;
+    learned->size      = tree->size;
+
+    learned->keys   = malloc((tree->size + 1) * sizeof(rb_key_t));
+    learned->nodes  = malloc((tree->size + 1) * sizeof(rb_node_t *));
+    learned->depths = malloc((tree->size + 1) * sizeof(int));
+
+    if (learned->keys == NULL || learned->nodes == NULL || learned->depths == NULL) {
+        rb_learned_free(learned);
+        return NULL;
+    }
+
+    for (node = rb_first(tree); node != NULL; node = rb_next(tree, node)) {
+        learned->keys[i]   = node->key;
+        learned->nodes[i]  = node;
+        learned->depths[i] = node_depth(tree, node);
+        i++;
+    }
+
+    if (build_segments(learned) == -1) {
+        rb_learned_free(learned);
+        return NULL;
+    }
+
+    return learned;
+}
+
+/* Count keys less than the search key in keys[lo, hi) (sorted) */
+static unsigned long count_less(const rb_key_t *keys, unsigned long lo,
+        unsigned long hi, rb_key_t skey) {
+    unsigned long i = lo, count = 0;
+
+#ifdef __AVX2__
+    // Unsigned compare as signed, after flipping the sign bits
+    __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    __m256i key  = _mm256_xor_si256(_mm256_set1_epi32((int)skey), bias);
+    __m256i v;
+
+    for (; i + 8 <= hi; i += 8) {
+        v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), bias);
+        count += __builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, v))));
+    }
+#elif defined(__SSE2__)
+    __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    __m128i key  = _mm_xor_si128(_mm_set1_epi32((int)skey), bias);
+    __m128i v;
+
+    for (; i + 4 <= hi; i += 4) {
+        v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+        count += __builtin_popcount(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key, v))));
+    }
+#endif
+
+    for (; i < hi; i++) {
+        count += (keys[i] < skey);
+    }
+
+    return count;
+}
+
+/* Find the key, returning the same depth and node as rb_find (-1 and NULL if absent) */
+int rb_learned_find(rb_learned_t *learned, rb_key_t skey, rb_node_t **found) {
+    rb_learned_seg_t *seg;
+    unsigned long lo, hi, mid, pos;
+    double pred;
+
+    if (found != NULL) {
+        *found = NULL;
+    }
+
+    if (learned->nsegs == 0 || skey < learned->seg_keys[0]) {
+        return -1;
+    }
+
+    // Last segment starting at or below the key
+    lo = 0;
+    hi = learned->nsegs;
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (learned->seg_keys[mid] <= skey) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    seg = &learned->segs[lo];
+
+    // Keys between two predicted ones are bracketed by them, one more for rounding
+    pred = seg->start + seg->slope * (double)(skey - learned->seg_keys[lo]);
+
+    lo = seg->start;
+    if (pred - learned->max_error - 1 > lo) {
+        lo = (unsigned long)(pred - learned->max_error - 1);
+    }
+    hi = seg->end;
+    if (pred + learned->max_error + 2 < hi) {
+        hi = (unsigned long)(pred + learned->max_error + 2);
+    }
+    if (lo > hi) {
+        // Key is past the last one of the segment
+        lo = hi;
+    }
+
+    pos = lo + count_less(learned->keys, lo, hi, skey);
+
+    if (pos >= learned->size || learned->keys[pos] != skey) {
+        return -1;
+    }
+
+    if (found != NULL) {
+        *found = learned->nodes[pos];
+    }
+
+    return learned->depths[pos];
+}
+
+/* Free the learned index (the tree is left as is) */
+void rb_learned_free(rb_learned_t *learned) {
+    free(learned->segs);
+    free(learned->seg_keys);
+    free(learned->depths);
+    free(learned->nodes);
+    free(learned->keys);
+    free(learned);
+}
@@ -0,0 +1,36 @@
+#ifndef __RBT_LEARNED_H__
+#define __RBT_LEARNED_H__
+
+#include "rbt.h"
+
+// Linear model of key -> position over one run of sorted keys
+struct rb_learned_seg_s {
+    double        slope;
+    unsigned long start;    // position of the first key
+    unsigned long end;      // position after the last key
+};
+
+// Learned index over a frozen snapshot of the keys
+// (a lookup is a model prediction plus a search of a few keys around it)
+struct rb_learned_s {
+    rb_key_t                *keys;      // sorted, searched within the error window
+    struct rb_node_s       **nodes;     // node of each key
+    int                     *depths;    // depth rb_find reported for each key
+    unsigned long            size;
+
+    rb_key_t                *seg_keys;  // first key of each segment
+    struct rb_learned_seg_s *segs;
+    unsigned long            nsegs;
+    int                      max_error; // prediction is off by at most this
+};
+
+typedef struct rb_learned_seg_s rb_learned_seg_t;
+typedef struct rb_learned_s     rb_learned_t;
+
+
+// Learned index implementation
+rb_learned_t *rb_learned_build(rb_tree_t *tree, int max_error);
+int           rb_learned_find(rb_learned_t *learned, rb_key_t skey, rb_node_t **found);
+void          rb_learned_free(rb_learned_t *learned);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rbt.h"
+
+#define TASKS_PER_THREAD    8   // sub-trees per thread, so stealing can even out
+
+// Unit of work (a whole sub-tree, or only its root)
+struct task_s {
+    rb_node_t *root;
+    int        whole;   // 0 visits root only (node above the split depth)
+};
+
+// Per-thread deque (owner pops the back, thieves steal the front)
+struct deque_s {
+    pthread_mutex_t lock;
+    struct task_s  *tasks;
+    int             head;
+    int             tail;
+};
+
+// Shared state of one parallel traversal
+struct pool_s {
+    struct deque_s *deques;
+    int             nthreads;
+
+    rb_visit_t      fn;
+    char           *parts;      // per-thread accumulators
+    int             acc_size;
+};
+
+// Threads kept between traversals (started on first use, added on demand)
+struct crew_s {
+    pthread_mutex_t call;       // one traversal at a time
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;       // new job posted (or stop)
+    pthread_cond_t  done;       // last worker of the job finished
+
+    pthread_t      *threads;    // thread i + 1 works as worker i + 1
+    int             nstarted;
+
+    struct pool_s  *job;
+    unsigned long   gen;        // bumped on each job
+    int             running;    // workers still on the job
+    int             stop;
+};
+
+typedef struct task_s   task_t;
+typedef struct deque_s  deque_t;
+typedef struct pool_s   pool_t;
+typedef struct crew_s   crew_t;
+
+static crew_t crew = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    NULL, 0, NULL, 0, 0, 0
+};
+
+/* Visit all nodes of the sub-tree in order (uses parent pointers, no stack) */
+static void visit_subtree(rb_node_t *root, rb_visit_t fn, void *acc) {
+    rb_node_t *node = root;
+
+    if (node == NULL) {
+        return;
+    }
+
+    while (node->left != NULL) {
+        node = node->left;
+    }
+
+    while (1) {
+        fn(node, acc);
+
+        if (node->right != NULL) {
+            // Successor is the leftmost of the right sub-tree
+            node = node->right;
+            while (node->left != NULL) {
+                node = node->left;
+            }
+
+        } else {
+            // Successor is the first ancestor reached from its left
+            while (node != root && node->parent->right == node) {
+                node = node->parent;
+            }
+            if (node == root) {
+                return;
+            }
+            node = node->parent;
+        }
+    }
+}
+
+/* Split the tree into tasks down to the depth */
+static void split(rb_node_t *node, int depth, task_t *tasks, int *ntasks) {
+    if (node == NULL) {
+        return;
+    }
+
+    if (depth == 0) {
+        tasks[*ntasks].root  = node;
+        tasks[*ntasks].whole = 1;
+        ++*ntasks;
+        return;
+    }
+
+    tasks[*ntasks].root  = node;
+    tasks[*ntasks].whole = 0;
+    ++*ntasks;
+
+    split(node->left,  depth - 1, tasks, ntasks);
+    split(node->right, depth - 1, tasks, ntasks);
+}
+
+/* Take a task from own deque, or steal one from the others */
+static int take_task(pool_t *pool, int id, task_t *task) {
+    deque_t *deque;
+    int i, found = 0;
+
+    // Own deque, newest first
+    deque = &pool->deques[id];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        *task = deque->tasks[--deque->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    // Steal the oldest task of a victim
+    for (i = 1; !found && i < pool->nthreads; i++) {
+        deque = &pool->deques[(id + i) % pool->nthreads];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+            *task = deque->tasks[deque->head++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    return found;
+}
+
+/* Run tasks as the worker until every deque is empty */
+static void work(pool_t *pool, int id) {
+    void  *acc = pool->parts + (size_t)id * pool->acc_size;
+    task_t task;
+
+    // Tasks never create tasks, so empty deques mean the work is done
+    while (take_task(pool, id, &task)) {
+        if (task.whole) {
+            visit_subtree(task.root, pool->fn, acc);
+        } else {
+            pool->fn(task.root, acc);
+        }
+    }
+}
+
+/* Crew thread, sleeps until a job needs it */
+static void *crew_main(void *arg) {
+    int id = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+    pool_t *job;
+
+    pthread_mutex_lock(&crew.lock);
+    while (1) {
+        while (crew.gen == seen && !crew.stop) {
+            pthread_cond_wait(&crew.wake, &crew.lock);
+        }
+        if (crew.stop) {
+            break;
+        }
+        seen = crew.gen;
+
+        // Jobs with fewer threads leave the rest asleep
+        if ((job = crew.job) == NULL || id >= job->nthreads) {
+            continue;
+        }
+
+        pthread_mutex_unlock(&crew.lock);
+        work(job, id);
+        pthread_mutex_lock(&crew.lock);
+
+        if (--crew.running == 0) {
+            pthread_cond_signal(&crew.done);
+        }
+    }
+    pthread_mutex_unlock(&crew.lock);
+
+    return NULL;
+}
+
+/* Start crew threads up to the count (keeps the ones started on failure) */
+static void crew_grow(int count) {
+    pthread_t *threads;
+
+    if (count <= crew.nstarted) {
+        return;
+    }
+
+    if ((threads = realloc(crew.threads, sizeof(pthread_t) * count)) == NULL) {
+        return;
+    }
+    crew.threads = threads;
+
+    while (crew.nstarted < count) {
+        if (pthread_create(&crew.threads[crew.nstarted], NULL, crew_main,
+                (void *)(intptr_t)(crew.nstarted + 1)) != 0) {
+            return;
+        }
+        crew.nstarted++;
+    }
+}
+
+/* Stop and join the threads kept for parallel traversals
+ * the next traversal starts them again */
+void rb_parallel_shutdown() {
+    int i;
+
+    pthread_mutex_lock(&crew.call);
+
+    pthread_mutex_lock(&crew.lock);
+    crew.stop = 1;
+    pthread_cond_broadcast(&crew.wake);
+    pthread_mutex_unlock(&crew.lock);
+
+    for (i = 0; i < crew.nstarted; i++) {
+        pthread_join(crew.threads[i], NULL);
+    }
+
+    free(crew.threads);
+    crew.threads  = NULL;
+    crew.nstarted = 0;
+    crew.stop     = 0;
+
+    pthread_mutex_unlock(&crew.call);
+}
+
+/* Visit every node with nthreads threads
+ * fn gets a per-thread copy of *acc (so acc should start as identity value),
+ * and the copies are merged back by reduce(acc, part), also when the tree
+ * is too small to share and is visited by the calling thread alone
+ * threads are kept for the next call; if fewer can be started, the others
+ * steal the tasks dealt to the missing ones */
+int rb_foreach_parallel(rb_tree_t *tree, rb_visit_t fn, rb_reduce_t reduce,
+        void *acc, int acc_size, int nthreads) {
+    pool_t    pool;
+    task_t   *tasks = NULL;
+    task_t   *slots = NULL;
+    char     *parts = NULL;
+    int depth, maxtasks, ntasks, i, ret = -1;
+
+    // Small array, or nothing to share: a single part, visited by the caller
+    if ((tree->small != NULL && tree->small->active)
+            || nthreads <= 1 || tree->size < (unsigned long)nthreads * TASKS_PER_THREAD) {
+        if ((parts = malloc(acc_size)) == NULL) {
+            return -1;
+        }
+        memcpy(parts, acc, acc_size);
+
+        if (tree->small != NULL && tree->small->active) {
+            for (i = 0; i < tree->small->count; i++) {
+                fn(&tree->small->nodes[i], parts);
+            }
+        } else {
+            visit_subtree(tree->root, fn, parts);
+        }
+
+        reduce(acc, parts);
+        free(parts);
+
+        return 0;
+    }
+
+    // Enough sub-trees to give each thread several of them
+    for (depth = 0; (1 << depth) < nthreads * TASKS_PER_THREAD; depth++);
+
+    maxtasks = (2 << depth) - 1;
+
+    tasks   = malloc(sizeof(task_t) * maxtasks);
+    slots   = malloc(sizeof(task_t) * (maxtasks / nthreads + 1) * nthreads);
+    parts   = malloc((size_t)acc_size * nthreads);
+    pool.deques = malloc(sizeof(deque_t) * nthreads);
+
+    if (tasks == NULL || slots == NULL || parts == NULL || pool.deques == NULL) {
+        goto out;
+    }
+
+    ntasks = 0;
+    split(tree->root, depth, tasks, &ntasks);
+
+    pool.nthreads = nthreads;
+    pool.fn       = fn;
+    pool.parts    = parts;
+    pool.acc_size = acc_size;
+
+    // Deal tasks round robin, each thread starts from its own accumulator
+    for (i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].tasks = slots + i * (maxtasks / nthreads + 1);
+        pool.deques[i].head  = 0;
+        pool.deques[i].tail  = 0;
+
+        memcpy(parts + (size_t)i * acc_size, acc, acc_size);
+    }
+    for (i = 0; i < ntasks; i++) {
+        deque_t *deque = &pool.deques[i % nthreads];
+        deque->tasks[deque->tail++] = tasks[i];
+    }
+
+    pthread_mutex_lock(&crew.call);
+    crew_grow(nthreads - 1);
+
+    // Wake the crew, the calling thread works as worker 0
+    pthread_mutex_lock(&crew.lock);
+    crew.job     = &pool;
+    crew.running = (crew.nstarted < nthreads - 1) ? crew.nstarted : nthreads - 1;
+    crew.gen++;
+    pthread_cond_broadcast(&crew.wake);
+    pthread_mutex_unlock(&crew.lock);
+
+    work(&pool, 0);
+
+    pthread_mutex_lock(&crew.lock);
+    while (crew.running > 0) {
+        pthread_cond_wait(&crew.done, &crew.lock);
+    }
+    crew.job = NULL;
+    pthread_mutex_unlock(&crew.lock);
+
+    pthread_mutex_unlock(&crew.call);
+
+    // Merge per-thread results
+    for (i = 0; i < nthreads; i++) {
+        reduce(acc, parts + (size_t)i * acc_size);
+
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+
+    ret = 0;
+
+out:
+    free(pool.deques);
+    free(parts);
+    free(slots);
+    free(tasks);
+
+    return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef __RBT_TRACE_H__
+#define __RBT_TRACE_H__
+
+// Static tracepoints of the tree hot paths (provider "rbt")
+//
+// Build with -DRB_TRACE (needs <sys/sdt.h>, e.g. systemtap-sdt-dev).
+// Each probe is a single nop until a tracer attaches, and its arguments
+// are only evaluated at the probe site. Without RB_TRACE they compile to nothing.
+//
+//   insert_entry   (key)
+//   insert_return  (key, result, depth)    depth the key landed at, -1 on failure
+//   find_entry     (key)
+//   find_return    (key, depth)            depth is -1 if not found
+//   recoloring     (key, depth)            key and depth of the new RED parent
+//   double_red     (key, depth)            double red propagates to the key
+//   restructuring  (key, rotation)         rotation is RB_ROTATION_*
+//   rotate         (key, left)             AVL, treap and splay rotations
+
+#define RB_ROTATION_LL  0
+#define RB_ROTATION_LR  1
+#define RB_ROTATION_RL  2
+#define RB_ROTATION_RR  3
+
+#if defined(RB_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RB_PROBE_ENABLED
+#endif
+#endif
+
+#ifdef RB_PROBE_ENABLED
+#define RB_PROBE1(name, a)          STAP_PROBE1(rbt, name, a)
+#define RB_PROBE2(name, a, b)       STAP_PROBE2(rbt, name, a, b)
+#define RB_PROBE3(name, a, b, c)    STAP_PROBE3(rbt, name, a, b, c)
+#else
+#define RB_PROBE1(name, a)          do { } while (0)
+#define RB_PROBE2(name, a, b)       do { } while (0)
+#define RB_PROBE3(name, a, b, c)    do { } while (0)
+#endif
+
+#endif
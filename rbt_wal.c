@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "rbt_wal.h"
+
+#define WAL_INITIAL_BUF     (64 << 10)
+
+// Record header, followed by len bytes of encoded value
+struct wal_record_s {
+    unsigned int len;
+    unsigned int sum;       // checksum of the rest (detects a torn tail)
+    rb_key_t     key;
+    int          op;        // RB_OP_*
+};
+
+typedef struct wal_record_s wal_record_t;
+
+/* Checksum of a record (FNV-1a over header fields and value) */
+static unsigned int record_sum(const wal_record_t *rec, const char *value) {
+    unsigned int h = 2166136261u;
+    unsigned int i;
+
+    h = (h ^ rec->len) * 16777619u;
+    h = (h ^ rec->key) * 16777619u;
+    h = (h ^ (unsigned int)rec->op) * 16777619u;
+
+    for (i = 0; i < rec->len; i++) {
+        h = (h ^ (unsigned char)value[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/* Make room for more bytes in the pending buffer */
+static int buf_reserve(rb_wal_t *wal, int more) {
+    char *buf;
+    int cap = wal->cap;
+
+    if (wal->len + more <= cap) {
+        return 0;
+    }
+
+    while (wal->len + more > cap) {
+        cap *= 2;
+    }
+
+    if ((buf = realloc(wal->buf, cap)) == NULL) {
+        return -1;
+    }
+
+    wal->buf = buf;
+    wal->cap = cap;
+
+    return 0;
+}
+
+/* Encode one record to the end of the buffer (no locking) */
+static int record_put(rb_wal_t *wal, int op, rb_key_t key, void *value) {
+    char vbuf[RB_WAL_MAX_VALUE];
+    wal_record_t rec;
+    int len = 0;
+
+    if (op == RB_OP_INSERT
+            && (len = wal->encode(value, vbuf, RB_WAL_MAX_VALUE)) < 0) {
+        return -1;
+    }
+
+    rec.len = len;
+    rec.key = key;
+    rec.op  = op;
+    rec.sum = record_sum(&rec, vbuf);
+
+    if (buf_reserve(wal, sizeof(rec) + len) == -1) {
+        return -1;
+    }
+
+    memcpy(wal->buf + wal->len, &rec, sizeof(rec));
+    memcpy(wal->buf + wal->len + sizeof(rec), vbuf, len);
+    wal->len += sizeof(rec) + len;
+
+    return 0;
+}
+
+/* Tree hook, appends the change for the next group commit */
+static void wal_hook(void *ctx, int op, rb_key_t key, void *value) {
+    rb_wal_t *wal = (rb_wal_t *)ctx;
+    int empty;
+
+    pthread_mutex_lock(&wal->lock);
+
+    empty = (wal->len == 0);
+
+    if (record_put(wal, op, key, value) == -1) {
+        wal->error = -1;
+    } else {
+        wal->appended++;
+
+        // Committer sleeps only while there is nothing to write
+        if (empty) {
+            pthread_cond_signal(&wal->wake);
+        }
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+}
+
+/* Write all bytes (retrying short writes) */
+static int write_all(int fd, const char *buf, int len) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Append the group and make it durable
+ * a failed group is cut off again, so no torn record is left mid-log
+ * returns -1 on failure, -2 if the cut failed too (replay stops at the tear) */
+static int group_write(rb_wal_t *wal, const char *buf, int len) {
+    off_t end;
+
+    if ((end = lseek(wal->fd, 0, SEEK_END)) == -1) {
+        return -1;
+    }
+
+    if (write_all(wal->fd, buf, len) == 0 && fdatasync(wal->fd) == 0) {
+        return 0;
+    }
+
+    return (ftruncate(wal->fd, end) == 0) ? -1 : -2;
+}
+
+/* Group commit thread, one fsync for all records of a window */
+static void *committer(void *arg) {
+    rb_wal_t *wal = (rb_wal_t *)arg;
+    struct timespec window;
+    unsigned long seq;
+    char *buf;
+    int len, cap, ret;
+
+    window.tv_sec  = wal->interval_ms / 1000;
+    window.tv_nsec = (wal->interval_ms % 1000) * 1000000L;
+
+    pthread_mutex_lock(&wal->lock);
+
+    while (1) {
+        while (wal->len == 0 && !wal->stop) {
+            pthread_cond_wait(&wal->wake, &wal->lock);
+        }
+
+        if (wal->len == 0 && wal->stop) {
+            break;
+        }
+
+        // Let more records join the group
+        if (!wal->stop && wal->interval_ms > 0) {
+            pthread_mutex_unlock(&wal->lock);
+            nanosleep(&window, NULL);
+            pthread_mutex_lock(&wal->lock);
+        }
+
+        // Take the group, appenders go on with the spare buffer
+        buf = wal->buf;
+        len = wal->len;
+        cap = wal->cap;
+        seq = wal->appended;
+
+        wal->buf   = wal->spare;
+        wal->cap   = wal->spare_cap;
+        wal->len   = 0;
+        wal->spare = NULL;
+
+        pthread_mutex_unlock(&wal->lock);
+
+        ret = group_write(wal, buf, len);
+
+        pthread_mutex_lock(&wal->lock);
+
+        wal->spare     = buf;
+        wal->spare_cap = cap;
+
+        if (ret != 0 && wal->error != -2) {
+            wal->error = ret;
+        }
+        wal->committed = seq;
+        wal->groups++;
+
+        pthread_cond_broadcast(&wal->done);
+    }
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+/* Read the whole file (NULL with len 0 if it doesn't exist) */
+static char *read_file(int fd, long *len) {
+    struct stat st;
+    char *buf;
+    ssize_t n;
+    long off = 0;
+
+    *len = 0;
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        return NULL;
+    }
+
+    if ((buf = malloc(st.st_size)) == NULL) {
+        return NULL;
+    }
+
+    while (off < st.st_size) {
+        if ((n = pread(fd, buf + off, st.st_size - off, off)) <= 0) {
+            break;
+        }
+        off += n;
+    }
+
+    *len = off;
+
+    return buf;
+}
+
+/* Apply records to the tree, returning the length of the valid prefix */
+static long replay(rb_wal_t *wal, const char *buf, long len) {
+    wal_record_t rec;
+    const char *value;
+    void *decoded;
+    long off = 0;
+
+    while (off + (long)sizeof(rec) <= len) {
+        memcpy(&rec, buf + off, sizeof(rec));
+        value = buf + off + sizeof(rec);
+
+        // Torn or garbage tail ends the log
+        if (rec.len > RB_WAL_MAX_VALUE
+                || off + (long)sizeof(rec) + rec.len > len
+                || record_sum(&rec, value) != rec.sum) {
+            break;
+        }
+
+        // Values the tree doesn't keep are released
+        if (rec.op == RB_OP_INSERT) {
+            decoded = wal->decode(value, rec.len);
+            if (rb_insert(wal->tree, rec.key, decoded) != 0 && wal->release != NULL) {
+                wal->release(decoded);
+            }
+        } else if (rec.op == RB_OP_ERASE) {
+            rb_erase_range(wal->tree, rec.key, rec.key, wal->release);
+        }
+
+        off += sizeof(rec) + rec.len;
+    }
+
+    return off;
+}
+
+/* Load the last image and replay the log
+ * then log every change of the tree, made durable in groups of interval_ms
+ * release frees decoded values dropped by the replay (NULL if they own nothing) */
+rb_wal_t *rb_wal_open(rb_tree_t *tree, const char *path, rb_wal_encode_t encode,
+        rb_wal_decode_t decode, rb_free_t release, int interval_ms) {
+    rb_wal_t *wal;
+    char *buf, *image;
+    long len, valid;
+    int fd;
+
+    if (tree->hook != NULL || (wal = malloc(sizeof(rb_wal_t))) == NULL) {
+        return NULL;
+    }
+
+    memset(wal, 0, sizeof(rb_wal_t));
+    wal->tree        = tree;
+    wal->encode      = encode;
+    wal->decode      = decode;
+    wal->release     = release;
+    wal->interval_ms = interval_ms;
+
+    wal->path  = malloc(strlen(path) + 1);
+    image      = malloc(strlen(path) + 5);
+    wal->buf   = malloc(WAL_INITIAL_BUF);
+    wal->spare = malloc(WAL_INITIAL_BUF);
+    wal->cap = wal->spare_cap = WAL_INITIAL_BUF;
+
+    if (wal->path == NULL || image == NULL || wal->buf == NULL || wal->spare == NULL) {
+        goto fail;
+    }
+
+    strcpy(wal->path, path);
+    sprintf(image, "%s.img", path);
+
+    // Last image
+    if ((fd = open(image, O_RDONLY)) != -1) {
+        buf = read_file(fd, &len);
+        replay(wal, buf, len);
+        free(buf);
+        close(fd);
+    }
+
+    // Changes after the image, a torn tail is cut off
+    if ((wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+        goto fail;
+    }
+
+    buf   = read_file(wal->fd, &len);
+    valid = replay(wal, buf, len);
+    free(buf);
+
+    if (valid < len && ftruncate(wal->fd, valid) == -1) {
+        close(wal->fd);
+        goto fail;
+    }
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    pthread_cond_init(&wal->done, NULL);
+
+    if (pthread_create(&wal->committer, NULL, committer, wal) != 0) {
+        close(wal->fd);
+        goto fail;
+    }
+
+    free(image);
+
+    tree->hook     = wal_hook;
+    tree->hook_ctx = wal;
+
+    return wal;
+
+fail:
+    free(wal->spare);
+    free(wal->buf);
+    free(image);
+    free(wal->path);
+    free(wal);
+
+    return NULL;
+}
+
+/* Wait until every change so far is durable */
+int rb_wal_sync(rb_wal_t *wal) {
+    unsigned long target;
+    int ret;
+
+    pthread_mutex_lock(&wal->lock);
+
+    target = wal->appended;
+    pthread_cond_signal(&wal->wake);
+
+    while (wal->committed < target && wal->error == 0) {
+        pthread_cond_wait(&wal->done, &wal->lock);
+    }
+
+    ret = wal->error;
+
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+
+/* Write an image of the whole tree, then empty the log */
+int rb_wal_checkpoint(rb_wal_t *wal) {
+    rb_wal_t   image;
+    rb_node_t *node;
+    char *tmp, *img;
+    int fd, ret = -1;
+
+    if (rb_wal_sync(wal) != 0) {
+        return -1;
+    }
+
+    tmp = malloc(strlen(wal->path) + 9);
+    img = malloc(strlen(wal->path) + 5);
+
+    if (tmp == NULL || img == NULL) {
+        free(tmp);
+        free(img);
+        return -1;
+    }
+
+    sprintf(tmp, "%s.img.tmp", wal->path);
+    sprintf(img, "%s.img", wal->path);
+
+    // Image is a log of inserts, encoded into a private buffer
+    memset(&image, 0, sizeof(image));
+    image.encode = wal->encode;
+    image.cap    = WAL_INITIAL_BUF;
+
+    if ((image.buf = malloc(image.cap)) == NULL) {
+        goto out;
+    }
+
+    for (node = rb_first(wal->tree); node != NULL; node = rb_next(wal->tree, node)) {
+        if (record_put(&image, RB_OP_INSERT, node->key, node->value) == -1) {
+            goto out;
+        }
+    }
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        goto out;
+    }
+
+    if (write_all(fd, image.buf, image.len) == -1 || fsync(fd) == -1) {
+        close(fd);
+        goto out;
+    }
+    close(fd);
+
+    // Switch images atomically, replaying the old log over it is harmless
+    if (rename(tmp, img) == -1) {
+        goto out;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    if (ftruncate(wal->fd, 0) == 0 && fdatasync(wal->fd) == 0) {
+        ret = 0;
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+out:
+    free(image.buf);
+    free(tmp);
+    free(img);
+
+    return ret;
+}
+
+/* Make everything durable, and detach the log from the tree */
+int rb_wal_close(rb_wal_t *wal) {
+    int ret;
+
+    ret = rb_wal_sync(wal);
+
+    wal->tree->hook     = NULL;
+    wal->tree->hook_ctx = NULL;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = 1;
+    pthread_cond_signal(&wal->wake);
+    pthread_mutex_unlock(&wal->lock);
+
+    pthread_join(wal->committer, NULL);
+
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->wake);
+    pthread_cond_destroy(&wal->done);
+
+    close(wal->fd);
+
+    free(wal->spare);
+    free(wal->buf);
+    free(wal->path);
+    free(wal);
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef __RBT_WAL_H__
+#define __RBT_WAL_H__
+
+#include <pthread.h>
+
+#include "rbt.h"
+
+#define RB_WAL_MAX_VALUE    4096    // largest encoded value
+
+// Value serializers (the tree holds only pointers)
+typedef int   (*rb_wal_encode_t)(void *value, char *buf, int size); // length, or -1
+typedef void *(*rb_wal_decode_t)(const char *buf, int len);
+
+// Write-ahead log of a tree, made durable by a group commit thread
+struct rb_wal_s {
+    rb_tree_t      *tree;
+    char           *path;        // log file, last image is path + ".img"
+    int             fd;
+
+    rb_wal_encode_t encode;
+    rb_wal_decode_t decode;
+    rb_free_t       release;     // frees a decoded value the replay drops (may be NULL)
+
+    // Records waiting for the next group (swapped with spare by committer)
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;        // records are pending, or stop
+    pthread_cond_t  done;        // a group has become durable
+    char           *buf;
+    int             len, cap;
+    char           *spare;
+    int             spare_cap;
+
+    unsigned long   appended;    // number of records appended
+    unsigned long   committed;   // number of records durable
+    unsigned long   groups;      // number of fsync calls
+    int             error;       // -1 a group was lost (log cut back to the last one), -2 log is torn
+
+    pthread_t       committer;
+    int             interval_ms; // group commit window
+    int             stop;
+};
+
+typedef struct rb_wal_s rb_wal_t;
+
+
+// Write-ahead log implementation
+rb_wal_t   *rb_wal_open(rb_tree_t *tree, const char *path, rb_wal_encode_t encode,
+                rb_wal_decode_t decode, rb_free_t release, int interval_ms);
+int         rb_wal_sync(rb_wal_t *wal);
+int         rb_wal_checkpoint(rb_wal_t *wal);
+int         rb_wal_close(rb_wal_t *wal);
+
+#endif
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Run the example over the sample queries with a trace script attached
+#
+#   trace/run.sh rebalance | deep_lookups     (bpftrace)
+#   trace/run.sh perf                         (perf, counts every probe)
+
+cd "$(dirname "$0")/.." || exit 1
+
+make -C example test_trace > /dev/null || exit 1
+
+case "$1" in
+rebalance|deep_lookups)
+    # Probes attach to the binary, so the tracer starts first
+    sudo bpftrace "trace/$1.bt" &
+    tracer=$!
+    sleep 3
+
+    (cd example && ./test_trace < query_50k.txt > /dev/null)
+
+    sudo kill -INT $tracer
+    wait $tracer
+    ;;
+perf)
+    sudo perf buildid-cache --add ./example/test_trace
+    sudo perf probe -x ./example/test_trace -a 'sdt_rbt:*' > /dev/null
+    sudo perf stat -e 'sdt_rbt:*' \
+        sh -c 'cd example && ./test_trace < query_50k.txt > /dev/null'
+    sudo perf probe -d 'sdt_rbt:*' > /dev/null
+    ;;
+*)
+    echo "usage: $0 rebalance | deep_lookups | perf"
+    exit 1
+    ;;
+esac